@@ -2,10 +2,16 @@
  * cachelab.c - Cache Lab helper functions
  */
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "cachelab.h"
 #include <time.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CACHE_HAVE_AVX2  // the scans below are built whatever the -march
+#include <immintrin.h>
+#endif
 
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
@@ -16,7 +22,13 @@ int func_counter = 0;
  */
 void csimHelper() {
     puts(
-        "Usage: ./csim [-hvc] -s <num> -E <num> -b <num> -t <file>\n"
+        "Usage: ./csim [-hvc] [-P <policy>] [-W <write>] [-F <prefetcher>]\n"
+        "              [-C <num>] -s <num> -E <num> -b <num> -t <file>\n"
+        "       ./csim -B <num> [-P <policy>] -s <num> -E <num> -b <num> -t <file>\n"
+        "       ./csim -P opt -s <num> -E <num> -b <num> -t <file>\n"
+        "       ./csim -A <num> -s <num> -b <num> -t <file>\n"
+        "       ./csim -L <level> [-L <level> ...] -t <file>\n"
+        "The -B, -P opt, -A and -L forms take no other options.\n"
         "Options:\n"
         "  -h         Print this help message.\n"
         "  -v         Optional verbose flag.\n"
@@ -25,13 +37,68 @@ void csimHelper() {
         "  -E <num>   Number of lines per set.\n"
         "  -b <num>   Number of block offset bits.\n"
         "  -t <file>  Trace file.\n"
+        "  -B <num>   Time <num> replays of the trace in memory.\n"
+        "  -P <policy> Replacement policy: lru (default), fifo, lfu, random,\n"
+        "             tree-plru, bit-plru, srrip, brrip, or opt (Belady's\n"
+        "             optimal, printed after LRU for comparison).\n"
+        "  -W <write> Write policy: wb (write-back, default) or wt (write-\n"
+        "             through), then :wa (write-allocate, default) or :nwa.\n"
+        "  -F <prefetcher> Prefetch with next-line or stream, described as\n"
+        "             <kind>[:degree[:distance[:latency]]]; the latency,\n"
+        "             in accesses, tells late prefetches. Default 1:1:16.\n"
+        "  -C <num>   Classify misses as compulsory, capacity or conflict,\n"
+        "             in total and per region of 2^<num> bytes.\n"
+        "  -A <num>   Simulate every E from 1 to <num> in one pass (LRU).\n"
+        "  -L <level> Add a level below the previous ones, described as\n"
+        "             s:E:b[:inc|:exc][:wt][:nwa][:<policy>]. inc/exc:\n"
+        "             inclusive/exclusive of the levels above, wt/nwa:\n"
+        "             as in -W.\n"
         "\n"
         "Examples:\n"
         "  linux>  ./csim -s 4 -E 1 -b 4 -t traces/yi.trace\n"
-        "  linux>  ./csim -v -s 8 -E 2 -b 4 -t traces/yi.trace"
+        "  linux>  ./csim -v -s 8 -E 2 -b 4 -t traces/yi.trace\n"
+        "  linux>  ./csim -L 6:8:6 -L 10:8:6:inc -t traces/trans.trace"
     );
 }
 
+/* Parse one line of a valgrind trace into `acc`.
+ * Return 1 for a data access, 0 for anything else.
+ */
+int parseTraceLine(const char* line, mem_access_t* acc) {
+    if (line[0] != ' ')  // instruction fetch or valgrind banner
+        return 0;
+    if (line[1] != 'L' && line[1] != 'S' && line[1] != 'M')
+        return 0;
+    char* end;
+    acc->op = line[1];
+    acc->addr = strtoul(&line[3], &end, 16);
+    acc->size = *end == ',' ? strtoul(end + 1, NULL, 10) : 1;
+    return 1;
+}
+
+/* Read the data accesses of a trace file into a new array.
+ * Store their number in `n`; return NULL if the file can't be read.
+ */
+mem_access_t* readTrace(const char* path, size_t* n) {
+    FILE* fp;
+    char line_buf[MAX_TRACELINE_LEN];
+    size_t cap = 1 << 16;
+    mem_access_t* accs;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return NULL;
+    accs = (mem_access_t*)malloc(cap * sizeof(mem_access_t));
+    *n = 0;
+    while (accs && fgets(line_buf, MAX_TRACELINE_LEN, fp)) {
+        if (!parseTraceLine(line_buf, &accs[*n]))
+            continue;
+        if (++*n == cap)
+            accs = (mem_access_t*)realloc(accs, (cap *= 2) * sizeof(mem_access_t));
+    }
+    fclose(fp);
+    return accs;
+}
+
 cache_t* initCache(unsigned int E, unsigned int s, unsigned int b) {
     /* Init cache parameters */
     unsigned int sb = s + b;
@@ -55,46 +122,46 @@ cache_t* initCache(unsigned int E, unsigned int s, unsigned int b) {
     *(unsigned long*)&cache->tmask = tmask;
     *(unsigned long*)&cache->smask = smask;
     cache->hits = cache->misses = cache->evictions = 0;
-    
-    /* Allocate memory for cachelines */
-    cache->blks  = (cblock_t**)malloc(S * sizeof(cblock_t*));  // S x E cache blocks
-    cache->heads = (cblock_t**)malloc(S * sizeof(cblock_t*));  // MRU heads for sets
-    cache->tails = (cblock_t**)malloc(S * sizeof(cblock_t*));  // LRU tails for sets
-    for (int i = 0; i < S; i++) {
-        cblock_t* cset = (cblock_t*)malloc(E * sizeof(cblock_t));
-        cblock_t* blk = cset;
-        for (int j = 0; j < E; j++, blk++) {
-            blk->tag = 0ul;
-            blk->data = (char*)malloc(B);
-            blk->prev = blk - 1;
-            blk->next = blk + 1;
-            blk->valid = 0;
-            // blk->prev = j? blk - 1 : NULL;
-            // blk->next = j < E-1? blk + 1 : NULL;
-            
-            blk->idx = j; // DEBUGGING
-        }
-        --blk;  // tail block
-        cset->prev = NULL;
-        blk->next  = NULL;
-        cache->blks [i] = cset;
-        cache->heads[i] = cset;
-        cache->tails[i] = blk;
-    }
+    cache->writebacks = 0;
+    cache->installs = 0;
+    cache->write_through = 0;
+    cache->write_no_alloc = 0;
+    cache->bytes_read = cache->bytes_written = 0;
+    cache->victim = 0;
+    cache->victim_dirty = 0;
+    cache->clock = 0;
+    cache->policy = CACHE_POLICY_LRU;
+    cache->rng = 0x9e3779b97f4a7c15ul;
+    cache->plru = NULL;
+    cache->pf = NULL;
+    cache->next_use = NULL;
+    cache->now = 0;
+    cache->last_set = 0;
+    cache->last_line = CACHEBLK_NIL;
+#ifdef CACHE_HAVE_AVX2
+    cache->simd = E >= CACHE_SIMD_MIN_E && __builtin_cpu_supports("avx2");
+#else
+    cache->simd = 0;
+#endif
+
+    /* Allocate the line arrays: S x E lines, set-major */
+    cache->tags   = (unsigned long*)malloc((size_t)S * E * sizeof(unsigned long));
+    cache->stamps = (unsigned long*)calloc((size_t)S * E, sizeof(unsigned long));
+    cache->flags  = (unsigned char*)calloc((size_t)S * E, sizeof(unsigned char));
+    for (size_t i = 0; i < (size_t)S * E; i++)
+        cache->tags[i] = CACHE_TAG_NONE;
 
     return cache;
 }
 
 void freeCache(cache_t* cache) {
-    for (int i = 0; i < cache->S; i++) {
-        cblock_t* cset = cache->blks[i];
-        for (int j = 0; j < cache->E; j++)
-            free(cset[j].data);
-        free(cset);
-    }
-    free(cache->blks);
-    free(cache->heads);
-    free(cache->tails);
+    free(cache->tags);
+    free(cache->stamps);
+    free(cache->flags);
+    free(cache->plru);
+    if (cache->pf)
+        free(cache->pf->ready);
+    free(cache->pf);
     free(cache);
 }
 
@@ -104,105 +171,401 @@ void cacheDecodeAddr(cache_t* cache, unsigned long addr, addr_id_t* id) {
     id->bbits = (addr & cache->bmask);
 }
 
-/* Find the block specified by set and tag and
- * return the block index; Return -1 on miss.
- * // To invalidate a block, set vbit = 0 and move block to tail.
- */  
-cblock_t* cacheFindBlk(cache_t* cache, unsigned long set, unsigned long tag) {
-    /* Linear search from MRU --> LRU for matching tag */
-    for (cblock_t* blk = cache->heads[set]; blk; blk = blk->next) {
-        if (!blk->valid)  // miss. Found free block : Tail is free block
-            return NULL;
-        if (tag == blk->tag) // hit.
-            return blk;
+#ifdef CACHE_HAVE_AVX2
+/* The AVX2 scans compare four 64-bit tags or stamps per instruction.
+ * They cover the first `n` ways of a set, `n` a multiple of 4, and are
+ * kept out of line so the scalar paths of small sets stay lean. They
+ * are compiled for AVX2 on their own, and only called (cache->simd) if
+ * the CPU running the simulator has it.
+ */
+static __attribute__((noinline, target("avx2")))
+int cacheMatchTagAVX2(const unsigned long* tags, unsigned int n, unsigned long tag) {
+    const __m256i key = _mm256_set1_epi64x((long long)tag);
+    int hit = CACHEBLK_NIL;
+    for (unsigned int way = 0; way < n; way += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&tags[way]), key);
+        unsigned int match = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        hit = match ? (int)(way + __builtin_ctz(match)) : hit;
+    }
+    return hit;
+}
+
+/* Keep a running minimum stamp and its way in each of four lanes, then
+ * fold the lanes; on equal stamps the lower way wins, as in the scalar
+ * scan. Stamps never reach 2^63, so the signed compare is safe.
+ */
+static __attribute__((noinline, target("avx2")))
+unsigned int cacheOldestAVX2(const unsigned long* stamps, unsigned int n, unsigned long* oldest) {
+    const __m256i four = _mm256_set1_epi64x(4);
+    __m256i idx = _mm256_setr_epi64x(0, 1, 2, 3);
+    __m256i minv = _mm256_set1_epi64x(LLONG_MAX);
+    __m256i mini = idx;
+    for (unsigned int way = 0; way < n; way += 4) {
+        __m256i st = _mm256_loadu_si256((const __m256i*)&stamps[way]);
+        __m256i lt = _mm256_cmpgt_epi64(minv, st);
+        minv = _mm256_blendv_epi8(minv, st, lt);
+        mini = _mm256_blendv_epi8(mini, idx, lt);
+        idx = _mm256_add_epi64(idx, four);
+    }
+    for (int half = 0; half < 2; half++) {  // lanes 2,3 onto 0,1, then 1 onto 0
+        __m256i pmin = half ? _mm256_shuffle_epi32(minv, 0x4e)
+                            : _mm256_permute4x64_epi64(minv, 0x4e);
+        __m256i pidx = half ? _mm256_shuffle_epi32(mini, 0x4e)
+                            : _mm256_permute4x64_epi64(mini, 0x4e);
+        __m256i lt = _mm256_or_si256(_mm256_cmpgt_epi64(minv, pmin),
+                     _mm256_and_si256(_mm256_cmpeq_epi64(minv, pmin),
+                                      _mm256_cmpgt_epi64(mini, pidx)));
+        minv = _mm256_blendv_epi8(minv, pmin, lt);
+        mini = _mm256_blendv_epi8(mini, pidx, lt);
+    }
+    *oldest = (unsigned long)_mm256_extract_epi64(minv, 0);
+    return (unsigned int)_mm256_extract_epi64(mini, 0);
+}
+#endif
+
+/* Find the line holding `tag` in cacheset `set` and
+ * return its index; Return CACHEBLK_NIL on miss.
+ * Invalid lines hold CACHE_TAG_NONE, so only tags are compared.
+ */
+int cacheFindBlk(cache_t* cache, unsigned long set, unsigned long tag) {
+    unsigned long* tags = &cache->tags[set * cache->E];
+    unsigned int way = 0;
+    int hit = CACHEBLK_NIL;
+
+    /* A run of accesses to one block, as in a scan, hits the last line used */
+    if (set == cache->last_set && cache->last_line != CACHEBLK_NIL &&
+        cache->tags[cache->last_line] == tag)
+        return cache->last_line;
+#ifdef CACHE_HAVE_AVX2
+    if (cache->simd) {
+        way = cache->E & ~3u;
+        hit = cacheMatchTagAVX2(tags, way, tag);
+    }
+#endif
+    for (; way < cache->E; way++)
+        hit = tags[way] == tag ? (int)way : hit;  // no early exit to mispredict
+    return hit == CACHEBLK_NIL ? hit : (int)(set * cache->E) + hit;
+}
+
+static const char* const cache_policy_names[CACHE_NPOLICIES] = {
+    "lru", "fifo", "lfu", "opt", "random", "tree-plru", "bit-plru", "srrip", "brrip"
+};
+
+/* Return the CACHE_POLICY_xxx called `name`, or -1 */
+int cachePolicyByName(const char* name) {
+    for (int p = 0; p < CACHE_NPOLICIES; p++)
+        if (!strcmp(name, cache_policy_names[p]))
+            return p;
+    return -1;
+}
+
+/* Select the replacement policy of an empty cache. Return -1 if the
+ * PLRU policies can't handle its associativity, or for OPT without
+ * the next uses of cacheSetOracle.
+ */
+int cacheSetPolicy(cache_t* cache, int policy) {
+    unsigned int E = cache->E;
+    if (policy < 0 || policy >= CACHE_NPOLICIES)
+        return -1;
+    if (policy == CACHE_POLICY_OPT && cache->next_use == NULL)
+        return -1;
+    if (policy == CACHE_POLICY_TREE_PLRU || policy == CACHE_POLICY_BIT_PLRU) {
+        if (E > CACHE_PLRU_MAX_E || (policy == CACHE_POLICY_TREE_PLRU && (E & (E - 1))))
+            return -1;
+        free(cache->plru);
+        cache->plru = (unsigned long*)calloc(cache->S, sizeof(unsigned long));
+    }
+    cache->policy = policy;
+    return 0;
+}
+
+/* Make an empty cache replace with Belady's OPT, knowing the future:
+ * next_use[i] is the index of the next reference to the block of the
+ * i-th reference (see traceNextUse), and the cache is then fed exactly
+ * those references. The victim is the block used again the latest,
+ * which gives the fewest misses any policy can get.
+ */
+int cacheSetOracle(cache_t* cache, const unsigned int* next_use) {
+    cache->next_use = next_use;
+    return cacheSetPolicy(cache, CACHE_POLICY_OPT);
+}
+
+/* The OPT stamp of a line whose next use is access `next`: 1 for a
+ * block never used again, so stamp 0 still means invalid.
+ */
+static inline unsigned long optStamp(unsigned int next) {
+    return (unsigned long)CACHE_NEXT_NONE + 1 - next;
+}
+
+static inline unsigned long cacheRand(cache_t* cache) {
+    cache->rng ^= cache->rng << 13;
+    cache->rng ^= cache->rng >> 7;
+    cache->rng ^= cache->rng << 17;
+    return cache->rng;
+}
+
+/* Tree-PLRU keeps a binary tree over the ways in heap order, node 1
+ * being the root: bit `node` tells which half of its subtree to evict
+ * from, 1 for the right one. A use points the nodes above a way away
+ * from it; the victim is found by following them.
+ */
+static void plruTreeTouch(unsigned long* bits, unsigned int E, unsigned int way) {
+    unsigned long node = 1;
+    for (int k = __builtin_ctz(E) - 1; k >= 0; k--) {
+        unsigned long right = way >> k & 1;
+        *bits = right ? *bits & ~(1ul << node) : *bits | (1ul << node);
+        node = 2 * node + right;
     }
-    return NULL;  // miss. No free block : Tail is LRU
 }
 
-cblock_t* cacheGetLRU(cache_t* cache, unsigned long set) {
-    return cache->tails[set];
+/* Bit-PLRU sets the bit of a way on use, and clears all others when
+ * that sets the last one; the victim is the first way with a clear bit.
+ */
+static void plruBitTouch(unsigned long* bits, unsigned int E, unsigned int way) {
+    unsigned long full = E == 64 ? ~0ul : (1ul << E) - 1;
+    *bits |= 1ul << way;
+    if (*bits == full)
+        *bits = 1ul << way;
 }
 
-cblock_t* cacheGetMRU(cache_t* cache, unsigned long set) {
-    return cache->heads[set];
+#define RRIP_MAX 3  // 2-bit predictions: 0 near, 3 distant re-reference
+
+/* The victim of the policies without stamps to compare. Like
+ * cacheVictimWay it has no effect on the cache: the random draw and
+ * the RRIP aging happen when the line is filled.
+ */
+static __attribute__((noinline))
+unsigned int cacheVictimOther(cache_t* cache, unsigned long set) {
+    unsigned long* tags = &cache->tags[set * cache->E];
+    unsigned long* rrpv = &cache->stamps[set * cache->E];
+    unsigned long node = 1, bits;
+    unsigned int way, far = 0;
+
+    for (way = 0; way < cache->E; way++)
+        if (tags[way] == CACHE_TAG_NONE)
+            return way;
+    switch (cache->policy) {
+        case CACHE_POLICY_RANDOM:
+            return cache->rng % cache->E;
+        case CACHE_POLICY_TREE_PLRU:
+            bits = cache->plru[set];
+            while (node < cache->E)
+                node = 2 * node + (bits >> node & 1);
+            return node - cache->E;
+        case CACHE_POLICY_BIT_PLRU:
+            return __builtin_ctzl(~cache->plru[set]);
+        default:  // SRRIP, BRRIP: the first line predicted most distant
+            for (way = 1; way < cache->E; way++)
+                far = rrpv[way] > rrpv[far] ? way : far;
+            return far;
+    }
 }
 
-/* Move `blk` to the head of cacheset `set`
- * Set valid bit, optionally dirty bit
- * Modify `heads` and `tails` if needed 
+/* The way to replace in `set`: the first invalid one, else the LRU
+ * (or per cache->policy). Inlined into the miss path; most lookups
+ * hit and never need it.
  */
-void cacheUseBlk(cache_t* cache, unsigned long set, cblock_t* blk, int dirty) {
-    cblock_t* old_head = cache->heads[set];
-    cblock_t* prev_blk = blk->prev;
-    cblock_t* next_blk = blk->next;
+static inline unsigned int cacheVictimWay(cache_t* cache, unsigned long set) {
+    unsigned long* stamps = &cache->stamps[set * cache->E];
+    unsigned long oldest = ~0ul;
+    unsigned int lru = 0, way = 0;
+
+    if (cache->policy > CACHE_POLICY_OPT)
+        return cacheVictimOther(cache, set);
+#ifdef CACHE_HAVE_AVX2
+    if (cache->simd) {
+        way = cache->E & ~3u;
+        lru = cacheOldestAVX2(stamps, way, &oldest);
+    }
+#endif
+    for (; way < cache->E; way++) {
+        unsigned long stamp = stamps[way];
+        lru = stamp < oldest ? way : lru;  // branch-free: misses are random
+        oldest = stamp < oldest ? stamp : oldest;
+    }
+    return lru;
+}
+
+int cacheGetLRU(cache_t* cache, unsigned long set) {
+    return set * cache->E + cacheVictimWay(cache, set);
+}
+
+int cacheGetMRU(cache_t* cache, unsigned long set) {
+    unsigned long* stamps = &cache->stamps[set * cache->E];
+    unsigned int mru = 0;
+    for (unsigned int way = 1; way < cache->E; way++)
+        if (stamps[way] > stamps[mru])
+            mru = way;
+    return set * cache->E + mru;
+}
+
+/* Update the replacement state of the policies other than LRU for a
+ * hit on `line` of cacheset `set`. Out of line, so as not to slow LRU.
+ */
+static __attribute__((noinline))
+void cachePolicyHit(cache_t* cache, unsigned long set, int line) {
+    unsigned int way = line - set * cache->E;
+
+    switch (cache->policy) {
+        case CACHE_POLICY_LFU:
+            ++cache->stamps[line];
+            break;
+        case CACHE_POLICY_OPT:
+            cache->stamps[line] = optStamp(cache->next_use[cache->now++]);
+            break;
+        case CACHE_POLICY_TREE_PLRU:
+            plruTreeTouch(&cache->plru[set], cache->E, way);
+            break;
+        case CACHE_POLICY_BIT_PLRU:
+            plruBitTouch(&cache->plru[set], cache->E, way);
+            break;
+        case CACHE_POLICY_SRRIP:
+        case CACHE_POLICY_BRRIP:
+            cache->stamps[line] = 0;  // predicted near
+            break;
+        default:  // FIFO, random: hits don't matter
+            break;
+    }
+}
+
+/* Record a hit on `line` of cacheset `set` for the replacement policy
+ * (for LRU: make it the MRU line). Set dirty bit if `dirty`.
+ * Inlined into the hit path, which cacheUseBlk is too big to be.
+ */
+static inline void cacheHitBlk(cache_t* cache, unsigned long set, int line, int dirty) {
+    /* Using the last line again changes nothing but its use count,
+     * or its next use */
+    if (line != cache->last_line || cache->policy == CACHE_POLICY_LFU ||
+        cache->policy == CACHE_POLICY_OPT) {
+        if (cache->policy == CACHE_POLICY_LRU)
+            cache->stamps[line] = ++cache->clock;
+        else
+            cachePolicyHit(cache, set, line);
+        cache->last_set = set;
+        cache->last_line = line;
+    }
+    if (dirty)
+        cache->flags[line] |= CACHEBLK_DIRTY;
+}
 
-    blk->valid = 1;
-    blk->dirty = dirty;
+void cacheUseBlk(cache_t* cache, unsigned long set, int line, int dirty) {
+    cacheHitBlk(cache, set, line, dirty);
+}
 
-    if (prev_blk == NULL) return;  // blk is already head.
-    
-    // blk is not head.
-    if (next_blk == NULL)  // blk is tail, prev becomes the new tail of the set
-        cache->tails[set] = prev_blk;
-    else  // blk is not tail, update next_blk's prev
-        next_blk->prev = prev_blk;
+/* Set the replacement state of `line`, just filled, for the policies
+ * other than LRU and FIFO; `evicted` tells whether it replaced a valid
+ * line.
+ */
+static __attribute__((noinline))
+void cachePolicyFill(cache_t* cache, unsigned long set, int line, int evicted) {
+    unsigned long* rrpv = &cache->stamps[set * cache->E];
+    unsigned int way = line - set * cache->E;
 
-    // move blk to head
-    prev_blk->next = next_blk;
-    old_head->prev = blk;
-    blk->next = old_head;
-    blk->prev = NULL;
-    cache->heads[set] = blk;
+    switch (cache->policy) {
+        case CACHE_POLICY_LFU:
+            cache->stamps[line] = 1;
+            break;
+        case CACHE_POLICY_OPT:
+            cache->stamps[line] = optStamp(cache->next_use[cache->now++]);
+            break;
+        case CACHE_POLICY_RANDOM:
+            if (evicted)
+                cacheRand(cache);  // the next random victim
+            break;
+        case CACHE_POLICY_TREE_PLRU:
+            plruTreeTouch(&cache->plru[set], cache->E, way);
+            break;
+        case CACHE_POLICY_BIT_PLRU:
+            plruBitTouch(&cache->plru[set], cache->E, way);
+            break;
+        default:  // SRRIP, BRRIP
+            if (evicted && rrpv[way] < RRIP_MAX) {
+                /* Age the set until the victim is predicted distant */
+                unsigned long age = RRIP_MAX - rrpv[way];
+                for (unsigned int w = 0; w < cache->E; w++)
+                    rrpv[w] += age;
+            }
+            /* Insert at long re-reference; BRRIP mostly at distant */
+            rrpv[way] = RRIP_MAX - 1;
+            if (cache->policy == CACHE_POLICY_BRRIP && cacheRand(cache) % 32)
+                rrpv[way] = RRIP_MAX;
+            break;
+    }
 }
 
+/* Bring the block `tag` into `set`, evicting the LRU line (or per
+ * cache->policy) if the set is full, and return the line it now
+ * occupies, dirty if `dirty`. The evicted block is left in
+ * cache->victim for the level below; the caller counts the eviction,
+ * as a demand one or a prefetcher's.
+ */
+static inline int cacheFill(cache_t* cache, unsigned long set, unsigned long tag,
+                            int dirty, int* status) {
+    int line = set * cache->E + cacheVictimWay(cache, set);
+    *status = CACHEBLK_MISS_FREE;
+    if (cache->flags[line] & CACHEBLK_VALID) {
+        *status = CACHEBLK_MISS_EVICT;
+        cache->victim = (cache->tags[line] << (cache->s + cache->b)) | (set << cache->b);
+        cache->victim_dirty = !!(cache->flags[line] & CACHEBLK_DIRTY);
+        if (cache->victim_dirty) {
+            ++cache->writebacks;
+            cache->bytes_written += cache->B;
+        }
+        if (cache->flags[line] & CACHEBLK_PREFETCHED)
+            ++cache->pf->useless;
+    }
+    cache->tags[line] = tag;  // Update the tag
+    cache->flags[line] = CACHEBLK_VALID | (dirty ? CACHEBLK_DIRTY : 0);
+    if (cache->policy <= CACHE_POLICY_FIFO)
+        cache->stamps[line] = ++cache->clock;  // time of fill, and of use
+    else
+        cachePolicyFill(cache, set, line, *status == CACHEBLK_MISS_EVICT);
+    cache->last_set = set;
+    cache->last_line = line;
+    return line;
+}
 
 void cacheStore(cache_t* cache, addr_id_t* id, int* status) {
     // missing args: - data, - length
     unsigned long set = id->sbits;
     unsigned long tag = id->tbits;
-    cblock_t* blk = cacheFindBlk(cache, set, tag);
-    if (blk) {
+    int line = cacheFindBlk(cache, set, tag);
+    if (line != CACHEBLK_NIL) {
         /* Hit: Store data to cache block directly */
         *status = CACHEBLK_HIT;
         ++cache->hits;
+        cacheHitBlk(cache, set, line, !cache->write_through);  // Make line MRU, set dirty
+    } else if (cache->write_no_alloc) {
+        /* Miss: store data to memory only */
+        *status = CACHEBLK_MISS_FREE;
+        ++cache->misses;
     } else {
         /* Miss: Copy block from memory to LRU / free
                  cacheline, then store data to cache */
-        blk = cacheGetLRU(cache, set);  // LRU policy
-        *status = CACHEBLK_MISS_FREE;
-        if (blk->valid) {
-            *status = CACHEBLK_MISS_EVICT;
-            ++cache->evictions;
-            // TODO: If blk dirty, write back to MEM
-        }
-        blk->tag = tag;  // Update the tag
+        cacheFill(cache, set, tag, !cache->write_through, status);
+        cache->bytes_read += cache->B;
         ++cache->misses;
+        cache->evictions += *status == CACHEBLK_MISS_EVICT;
     }
-    cacheUseBlk(cache, set, blk, 1);  // Move block to head (MRU), set valid & dirty
 }
 
 void cacheLoad(cache_t* cache, addr_id_t* id, int* status) {
     unsigned long set = id->sbits;
     unsigned long tag = id->tbits;
-    cblock_t* blk = cacheFindBlk(cache, set, tag);
-    if (blk) {
+    int line = cacheFindBlk(cache, set, tag);
+    if (line != CACHEBLK_NIL) {
         /* Hit: Load data from cache block directly */
         *status = CACHEBLK_HIT;
         ++cache->hits;
+        cacheHitBlk(cache, set, line, 0);  // Make line MRU, keep dirty bit
     } else {
         /* Miss: Copy block from memory to LRU / free
                  cacheline, then load data from cache */
-        blk = cacheGetLRU(cache, set);  // LRU policy
-        *status = CACHEBLK_MISS_FREE;
-        if (blk->valid) {
-            *status = CACHEBLK_MISS_EVICT;
-            ++cache->evictions;
-            // TODO: If blk dirty, write back to MEM
-        }
-        blk->tag = tag;  // Update the tag
+        cacheFill(cache, set, tag, 0, status);
+        cache->bytes_read += cache->B;
         ++cache->misses;
+        cache->evictions += *status == CACHEBLK_MISS_EVICT;
     }
-    cacheUseBlk(cache, set, blk, 0);  // Move block to head (MRU), dirty = 0
 }
 
 void cacheModify(cache_t* cache, addr_id_t* id, int* status_0, int* status_1) {
@@ -210,6 +573,774 @@ void cacheModify(cache_t* cache, addr_id_t* id, int* status_0, int* status_1) {
     cacheStore(cache, id, status_1);
 }
 
+static const char* const cache_prefetcher_names[CACHE_NPREFETCHERS] = {
+    "none", "next-line", "stream"
+};
+
+/* Return the CACHE_PF_xxx called `name`, or -1 */
+int cachePrefetcherByName(const char* name) {
+    for (int k = 0; k < CACHE_NPREFETCHERS; k++)
+        if (!strcmp(name, cache_prefetcher_names[k]))
+            return k;
+    return -1;
+}
+
+/* Attach a prefetcher to an empty cache, for cachePrefetch to run
+ * after every access. Return -1 for an unknown kind or a zero degree.
+ */
+int cacheSetPrefetcher(cache_t* cache, int kind, unsigned int degree,
+                       unsigned int distance, unsigned int latency) {
+    prefetch_t* pf;
+
+    if (kind < 0 || kind >= CACHE_NPREFETCHERS || degree == 0)
+        return -1;
+    if (cache->pf)
+        free(cache->pf->ready);
+    free(cache->pf);
+    cache->pf = NULL;
+    if (kind == CACHE_PF_NONE)
+        return 0;
+    pf = (prefetch_t*)calloc(1, sizeof(prefetch_t));
+    pf->kind = kind;
+    pf->degree = degree;
+    pf->distance = distance;
+    pf->latency = latency;
+    pf->ready = (unsigned long*)calloc((size_t)cache->S * cache->E, sizeof(unsigned long));
+    for (int i = 0; i < CACHE_PF_FILTER; i++)
+        pf->filter[i] = CACHE_TAG_NONE;
+    cache->pf = pf;
+    return 0;
+}
+
+static inline size_t prefetchFilterSlot(unsigned long blk) {
+    return (blk * 0x9e3779b97f4a7c15ul) >> 32 & (CACHE_PF_FILTER - 1);
+}
+
+/* Bring block `blk` into the cache if it is absent. It is filled like a
+ * demand miss, but counts as neither a hit nor a miss.
+ */
+static void prefetchBlock(cache_t* cache, unsigned long blk) {
+    prefetch_t* pf = cache->pf;
+    unsigned long addr = blk << cache->b;
+    addr_id_t id;
+    int line, status;
+
+    if (blk >> (MAX_ADDR_BITS - cache->b))
+        return;  // past either end of the address space
+    cacheDecodeAddr(cache, addr, &id);
+    if (cacheFindBlk(cache, id.sbits, id.tbits) != CACHEBLK_NIL)
+        return;
+    line = cacheFill(cache, id.sbits, id.tbits, 0, &status);
+    if (status == CACHEBLK_MISS_EVICT) {
+        ++pf->evictions;
+        pf->filter[prefetchFilterSlot(cache->victim >> cache->b)] = cache->victim >> cache->b;
+    }
+    cache->flags[line] |= CACHEBLK_PREFETCHED;
+    cache->bytes_read += cache->B;
+    pf->ready[line] = pf->clock + pf->latency;
+    ++pf->issued;
+}
+
+/* Train the stream prefetcher on block `blk`. A stream is confirmed
+ * once the same stride is seen twice in a row, and then prefetches
+ * along it on every access.
+ */
+static void prefetchStream(cache_t* cache, unsigned long blk) {
+    prefetch_t* pf = cache->pf;
+    pf_stream_t* st = NULL;
+    pf_stream_t* oldest = &pf->streams[0];
+    long delta = 0;
+
+    for (int i = 0; i < CACHE_PF_STREAMS && st == NULL; i++) {
+        pf_stream_t* cand = &pf->streams[i];
+        delta = (long)(blk - cand->last);
+        if (cand->used && labs(delta) <= CACHE_PF_WINDOW)
+            st = cand;
+        else if (cand->used < oldest->used)
+            oldest = cand;
+    }
+    if (st == NULL) {
+        /* Start a stream in place of the least recently used one */
+        oldest->last = blk;
+        oldest->stride = 0;
+        oldest->conf = 0;
+        oldest->used = pf->clock;
+        return;
+    }
+    st->used = pf->clock;
+    if (delta == 0)
+        return;
+    if (delta == st->stride) {
+        st->conf += st->conf < 3;
+    } else {
+        st->stride = delta;
+        st->conf = 0;
+    }
+    st->last = blk;
+    if (st->conf > 0)
+        for (unsigned int k = 0; k < pf->degree; k++)
+            prefetchBlock(cache, blk + st->stride * (long)(pf->distance + k));
+}
+
+/* Run the prefetcher of `cache` right after its access `acc`, whose
+ * first reference had status `status`; on a hit, the line it used is
+ * still cache->last_line. Kept out of cacheAccess, so as not to slow
+ * the caches without a prefetcher.
+ */
+void cachePrefetch(cache_t* cache, const mem_access_t* acc, int status) {
+    prefetch_t* pf = cache->pf;
+    unsigned long blk = (acc->addr & ((1ul << MAX_ADDR_BITS) - 1)) >> cache->b;
+    unsigned long* slot;
+
+    ++pf->clock;
+    if (status == CACHEBLK_HIT) {
+        int line = cache->last_line;
+        if (!(cache->flags[line] & CACHEBLK_PREFETCHED))
+            return;
+        cache->flags[line] &= ~CACHEBLK_PREFETCHED;
+        ++pf->useful;
+        if (pf->ready[line] > pf->clock)
+            ++pf->late;
+    } else {
+        slot = &pf->filter[prefetchFilterSlot(blk)];
+        if (*slot == blk) {
+            ++pf->polluting;
+            *slot = CACHE_TAG_NONE;
+        }
+    }
+    switch (pf->kind) {
+        case CACHE_PF_NEXT_LINE:
+            for (unsigned int k = 0; k < pf->degree; k++)
+                prefetchBlock(cache, blk + pf->distance + k);
+            break;
+        case CACHE_PF_STREAM:
+            prefetchStream(cache, blk);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Simulate one trace access; status_1 is only set by a modify. */
+void cacheAccess(cache_t* cache, const mem_access_t* acc, int* status_0, int* status_1) {
+    addr_id_t id;
+
+    cacheDecodeAddr(cache, acc->addr, &id);
+    *status_1 = CACHEBLK_NIL;
+    switch (acc->op) {
+        case 'S':
+            cacheStore(cache, &id, status_0);
+            if (cache->write_through || (cache->write_no_alloc && *status_0 != CACHEBLK_HIT))
+                cache->bytes_written += acc->size;
+            break;
+        case 'L':
+            cacheLoad(cache, &id, status_0);
+            break;
+        case 'M':
+            cacheModify(cache, &id, status_0, status_1);
+            if (cache->write_through)  // the store of a modify always hits
+                cache->bytes_written += acc->size;
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Drop the block holding `addr` if present; return its flags, 0 if absent */
+static int cacheInvalidate(cache_t* cache, unsigned long addr) {
+    addr_id_t id;
+    int line, flags;
+
+    cacheDecodeAddr(cache, addr, &id);
+    line = cacheFindBlk(cache, id.sbits, id.tbits);
+    if (line == CACHEBLK_NIL)
+        return 0;
+    flags = cache->flags[line];
+    cache->tags[line] = CACHE_TAG_NONE;
+    cache->stamps[line] = 0;  // the next victim of its set, with stamps
+    cache->flags[line] = 0;
+    if (line == cache->last_line)
+        cache->last_line = CACHEBLK_NIL;
+    return flags;
+}
+
+/* Whether `cache` holds the block `addr` */
+static int cacheHolds(cache_t* cache, unsigned long addr) {
+    addr_id_t id;
+    cacheDecodeAddr(cache, addr, &id);
+    return cacheFindBlk(cache, id.sbits, id.tbits) != CACHEBLK_NIL;
+}
+
+/* Set the dirty bit of the block holding `addr`, which is present */
+static void cacheSetDirty(cache_t* cache, unsigned long addr) {
+    addr_id_t id;
+    cacheDecodeAddr(cache, addr, &id);
+    cache->flags[cacheFindBlk(cache, id.sbits, id.tbits)] |= CACHEBLK_DIRTY;
+}
+
+/* Place the block `addr` without a lookup being counted, as a victim
+ * from the level above moves into an exclusive level, or is written
+ * back. Return the fill status: CACHEBLK_MISS_EVICT if it evicted a
+ * block into cache->victim.
+ */
+static int cacheInsert(cache_t* cache, unsigned long addr, int dirty) {
+    addr_id_t id;
+    int line, status = CACHEBLK_HIT;
+
+    ++cache->installs;
+    cacheDecodeAddr(cache, addr, &id);
+    line = cacheFindBlk(cache, id.sbits, id.tbits);
+    if (line == CACHEBLK_NIL) {
+        cacheFill(cache, id.sbits, id.tbits, dirty, &status);
+        cache->evictions += status == CACHEBLK_MISS_EVICT;
+    } else
+        cacheHitBlk(cache, id.sbits, line, dirty);
+    return status;
+}
+
+
+hier_t* initHier(void) {
+    return (hier_t*)calloc(1, sizeof(hier_t));
+}
+
+void freeHier(hier_t* h) {
+    for (int i = 0; i < h->nlevels; i++)
+        freeCache(h->levels[i]);
+    free(h);
+}
+
+/* Append a level below the existing ones; return -1 if there are
+ * CACHE_MAX_LEVELS already.
+ */
+int hierAddLevel(hier_t* h, unsigned int E, unsigned int s, unsigned int b,
+                 int inclusion, int write_through) {
+    if (h->nlevels == CACHE_MAX_LEVELS)
+        return -1;
+    cache_t* cache = initCache(E, s, b);
+    cache->write_through = write_through;
+    h->inclusion[h->nlevels] = h->nlevels ? inclusion : CACHE_NINE;
+    h->levels[h->nlevels++] = cache;
+    return 0;
+}
+
+static int hierRead(hier_t* h, int i, unsigned long addr);
+static void hierWrite(hier_t* h, int i, unsigned long addr);
+static void hierWriteBack(hier_t* h, int i, unsigned long addr);
+
+/* Whether level i, which lacks the block `addr`, may take it in without
+ * reading it: only a plain write-allocate level whose inclusive levels
+ * below hold the block.
+ */
+static int hierMayInstall(hier_t* h, int i, unsigned long addr) {
+    if (h->inclusion[i] != CACHE_NINE || h->levels[i]->write_no_alloc)
+        return 0;
+    for (int lo = i + 1; lo < h->nlevels; lo++)
+        if (h->inclusion[lo] == CACHE_INCLUSIVE && !cacheHolds(h->levels[lo], addr))
+            return 0;
+    return 1;
+}
+
+/* Level i evicted the block `addr`: keep inclusion above it, then pass
+ * the block down as the level below expects.
+ */
+static void hierEvict(hier_t* h, int i, unsigned long addr, int dirty) {
+    if (h->inclusion[i] == CACHE_INCLUSIVE)
+        for (int up = 0; up < i; up++)
+            dirty |= !!(cacheInvalidate(h->levels[up], addr) & CACHEBLK_DIRTY);
+    if (i + 1 == h->nlevels) {
+        h->mem_writes += dirty;
+    } else if (h->inclusion[i + 1] == CACHE_EXCLUSIVE) {
+        cache_t* below = h->levels[i + 1];
+        if (cacheInsert(below, addr, dirty) == CACHEBLK_MISS_EVICT)
+            hierEvict(h, i + 1, below->victim, below->victim_dirty);
+    } else if (dirty) {
+        hierWriteBack(h, i + 1, addr);
+    }
+}
+
+/* Level i - 1 writes back the dirty block `addr`. The write covers the
+ * whole block, so a level that lacks it can install it without reading
+ * it from below. It passes the block down instead if it is exclusive
+ * (the block is above it), inclusive (it dropped the block already),
+ * no-write-allocate, or if an inclusive level below lacks the block.
+ */
+static void hierWriteBack(hier_t* h, int i, unsigned long addr) {
+    cache_t* cache;
+
+    if (i == h->nlevels) {
+        ++h->mem_writes;
+        return;
+    }
+    cache = h->levels[i];
+    if (h->inclusion[i] == CACHE_EXCLUSIVE ||
+        (!cacheHolds(cache, addr) && !hierMayInstall(h, i, addr))) {
+        hierWriteBack(h, i + 1, addr);
+        return;
+    }
+    if (cacheInsert(cache, addr, !cache->write_through) == CACHEBLK_MISS_EVICT)
+        hierEvict(h, i, cache->victim, cache->victim_dirty);
+    if (cache->write_through)
+        hierWriteBack(h, i + 1, addr);
+}
+
+/* After an access to level i, bring in the block from below on a miss
+ * and hand its victim down. Return whether the block came up dirty.
+ */
+static int hierFill(hier_t* h, int i, unsigned long addr, int status) {
+    cache_t* cache = h->levels[i];
+    unsigned long victim = cache->victim;
+    int victim_dirty = cache->victim_dirty;
+    int dirty = 0;
+
+    if (status == CACHEBLK_HIT)
+        return 0;
+    dirty = hierRead(h, i + 1, addr);  // before the victim can take its place below
+    if (status == CACHEBLK_MISS_EVICT)
+        hierEvict(h, i, victim, victim_dirty);
+    return dirty;
+}
+
+/* Level i - 1 (or the trace, for i = 0) reads the block `addr`.
+ * Return whether the block moves up dirty, out of an exclusive level.
+ */
+static int hierRead(hier_t* h, int i, unsigned long addr) {
+    cache_t* cache;
+    addr_id_t id;
+    int status;
+
+    if (i == h->nlevels) {
+        ++h->mem_reads;
+        return 0;
+    }
+    cache = h->levels[i];
+    if (h->inclusion[i] == CACHE_EXCLUSIVE) {
+        int flags = cacheInvalidate(cache, addr);
+        if (flags & CACHEBLK_VALID) {
+            ++cache->hits;
+            return !!(flags & CACHEBLK_DIRTY);
+        }
+        ++cache->misses;
+        return hierRead(h, i + 1, addr);
+    }
+    cacheDecodeAddr(cache, addr, &id);
+    cacheLoad(cache, &id, &status);
+    if (hierFill(h, i, addr, status))
+        cacheSetDirty(cache, addr);
+    return 0;
+}
+
+/* Level i - 1 (or the trace, for i = 0) writes to the block `addr`: a
+ * store or a write-through. Stores allocate on a miss unless the level
+ * is no-write-allocate.
+ */
+static void hierWrite(hier_t* h, int i, unsigned long addr) {
+    cache_t* cache;
+    addr_id_t id;
+    int status;
+
+    if (i == h->nlevels) {
+        ++h->mem_writes;
+        return;
+    }
+    cache = h->levels[i];
+    if (h->inclusion[i] == CACHE_EXCLUSIVE) {
+        hierWrite(h, i + 1, addr);  // the block is above, not here
+        return;
+    }
+    cacheDecodeAddr(cache, addr, &id);
+    cacheStore(cache, &id, &status);
+    if (cache->write_no_alloc && status != CACHEBLK_HIT) {
+        hierWrite(h, i + 1, addr);  // around this level
+        return;
+    }
+    hierFill(h, i, addr, status);
+    if (cache->write_through)
+        hierWrite(h, i + 1, addr);
+}
+
+/* Simulate one trace access on the hierarchy */
+void hierAccess(hier_t* h, const mem_access_t* acc) {
+    unsigned long addr = acc->addr & ((1ul << MAX_ADDR_BITS) - 1);
+    switch (acc->op) {
+        case 'L':
+            hierRead(h, 0, addr);
+            break;
+        case 'M':
+            hierRead(h, 0, addr);
+            // fall through
+        case 'S':
+            hierWrite(h, 0, addr);
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Map block numbers to times: linear probing over a table that doubles
+ * when it is half full.
+ */
+static void blkmapInit(blkmap_t* map, size_t cap) {
+    map->cap = cap;
+    map->count = 0;
+    map->keys = (unsigned long*)malloc(cap * sizeof(unsigned long));
+    map->vals = (unsigned long*)malloc(cap * sizeof(unsigned long));
+    for (size_t i = 0; i < cap; i++)
+        map->keys[i] = CACHE_TAG_NONE;
+}
+
+static void blkmapFree(blkmap_t* map) {
+    free(map->keys);
+    free(map->vals);
+}
+
+static size_t blkmapSlot(const blkmap_t* map, unsigned long blk) {
+    size_t i = (blk * 0x9e3779b97f4a7c15ul) >> 32 & (map->cap - 1);
+    while (map->keys[i] != blk && map->keys[i] != CACHE_TAG_NONE)
+        i = (i + 1) & (map->cap - 1);
+    return i;
+}
+
+/* Return the value slot of `blk`, adding it with value 0 if absent */
+static unsigned long* blkmapGet(blkmap_t* map, unsigned long blk) {
+    size_t i = blkmapSlot(map, blk);
+    if (map->keys[i] == CACHE_TAG_NONE) {
+        if (2 * (map->count + 1) > map->cap) {
+            blkmap_t old = *map;
+            blkmapInit(map, old.cap * 2);
+            for (size_t j = 0; j < old.cap; j++) {
+                if (old.keys[j] == CACHE_TAG_NONE)
+                    continue;
+                size_t k = blkmapSlot(map, old.keys[j]);
+                map->keys[k] = old.keys[j];
+                map->vals[k] = old.vals[j];
+            }
+            map->count = old.count;
+            blkmapFree(&old);
+            i = blkmapSlot(map, blk);
+        }
+        map->keys[i] = blk;
+        map->vals[i] = 0;
+        map->count++;
+    }
+    return &map->vals[i];
+}
+
+/* The next use of each reference of a trace with blocks of 2^b bytes,
+ * for OPT: a modify is two references, its load then its store, and
+ * next[r] is the index of the next reference to the block of reference
+ * r, or CACHE_NEXT_NONE. One backward pass remembers the latest index
+ * seen per block, so besides the result it only needs memory per
+ * distinct block. Return NULL if the indices don't fit in an unsigned int.
+ */
+unsigned int* traceNextUse(const mem_access_t* accs, size_t n, unsigned int b) {
+    unsigned int* next;
+    size_t refs = 0;
+    blkmap_t later;  // block -> 1 + index of its next reference, 0 if none
+
+    for (size_t i = 0; i < n; i++)
+        refs += accs[i].op == 'M' ? 2 : 1;
+    if (refs >= CACHE_NEXT_NONE ||
+        (next = (unsigned int*)malloc((refs ? refs : 1) * sizeof(unsigned int))) == NULL)
+        return NULL;
+    blkmapInit(&later, 1 << 12);
+    for (size_t i = n; i-- > 0; ) {
+        unsigned long blk = (accs[i].addr & ((1ul << MAX_ADDR_BITS) - 1)) >> b;
+        unsigned long* slot = blkmapGet(&later, blk);
+        for (int k = accs[i].op == 'M' ? 2 : 1; k > 0; k--) {
+            next[--refs] = *slot ? (unsigned int)(*slot - 1) : CACHE_NEXT_NONE;
+            *slot = refs + 1;
+        }
+    }
+    blkmapFree(&later);
+    return next;
+}
+
+/* Fenwick tree over positions 1..n: add `delta` at `i`, sum over 1..i */
+static void fenwickAdd(unsigned int* tree, unsigned long n, unsigned long i, int delta) {
+    for (; i <= n; i += i & -i)
+        tree[i] += delta;
+}
+
+static unsigned long fenwickSum(const unsigned int* tree, unsigned long i) {
+    unsigned long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += tree[i];
+    return sum;
+}
+
+/* Set up stack distances for the accesses of `accs`, which size the
+ * per-set trees; the accesses are simulated by stackDistAccess.
+ * Distances of `dmax` or more are not told apart.
+ */
+stackdist_t* initStackDist(unsigned int s, unsigned int b, unsigned int dmax,
+                           const mem_access_t* accs, size_t n) {
+    unsigned long S = 1ul << s;
+    unsigned long total = 0;
+
+    stackdist_t* sd = (stackdist_t*)malloc(sizeof(stackdist_t));
+    *(unsigned int*)&sd->s = s;
+    *(unsigned int*)&sd->b = b;
+    *(unsigned int*)&sd->dmax = dmax;
+    sd->refs = 0;
+    sd->hist     = (unsigned long*)calloc(dmax, sizeof(unsigned long));
+    sd->distinct = (unsigned long*)calloc(S, sizeof(unsigned long));
+    sd->clock    = (unsigned long*)calloc(S, sizeof(unsigned long));
+    sd->base     = (unsigned long*)calloc(S + 1, sizeof(unsigned long));
+
+    /* Set k owns tree[base[k]] .. tree[base[k] + refs of k], slot 0 unused */
+    for (size_t i = 0; i < n; i++) {
+        unsigned long blk = accs[i].addr >> b;
+        sd->base[blk & (S - 1)] += accs[i].op == 'M' ? 2 : 1;
+    }
+    for (unsigned long k = 0; k <= S; k++) {
+        unsigned long refs = sd->base[k];
+        sd->base[k] = total;
+        total += refs + 1;
+    }
+    sd->tree = (unsigned int*)calloc(total, sizeof(unsigned int));
+    blkmapInit(&sd->last, 1 << 12);
+    return sd;
+}
+
+void freeStackDist(stackdist_t* sd) {
+    free(sd->hist);
+    free(sd->distinct);
+    free(sd->clock);
+    free(sd->base);
+    free(sd->tree);
+    blkmapFree(&sd->last);
+    free(sd);
+}
+
+/* Record one reference to block `blk` */
+static void stackDistRef(stackdist_t* sd, unsigned long blk) {
+    unsigned long set = blk & ((1ul << sd->s) - 1);
+    unsigned int* tree = &sd->tree[sd->base[set]];
+    unsigned long n = sd->base[set + 1] - sd->base[set] - 1;  // tree size
+    unsigned long now = ++sd->clock[set];
+    unsigned long* prev = blkmapGet(&sd->last, blk);
+
+    ++sd->refs;
+    if (*prev) {
+        /* Every block with a 1 after `prev` was used since: marks up to
+         * now - 1 number the blocks seen, those up to prev come before */
+        unsigned long dist = sd->distinct[set] - fenwickSum(tree, *prev);
+        if (dist < sd->dmax)
+            ++sd->hist[dist];
+        fenwickAdd(tree, n, *prev, -1);
+    } else {
+        ++sd->distinct[set];  // cold reference, a miss for every E
+    }
+    fenwickAdd(tree, n, now, 1);
+    *prev = now;
+}
+
+/* Simulate one trace access; a modify is a load then a store */
+void stackDistAccess(stackdist_t* sd, const mem_access_t* acc) {
+    unsigned long blk = (acc->addr & ((1ul << MAX_ADDR_BITS) - 1)) >> sd->b;
+    switch (acc->op) {
+        case 'M':
+            stackDistRef(sd, blk);
+            // fall through
+        case 'L':
+        case 'S':
+            stackDistRef(sd, blk);
+            break;
+        default:
+            break;
+    }
+}
+
+/* The counts an E-way LRU cache (E <= dmax) would have for the accesses
+ * so far. A miss evicts unless its set still had a free line, which is
+ * the case for the first E distinct blocks of every set.
+ */
+void stackDistSummary(stackdist_t* sd, unsigned int E,
+                      unsigned long* hits, unsigned long* misses, unsigned long* evictions) {
+    unsigned long h = 0, filled = 0;
+    for (unsigned int d = 0; d < E && d < sd->dmax; d++)
+        h += sd->hist[d];
+    for (unsigned long k = 0; k < (1ul << sd->s); k++)
+        filled += sd->distinct[k] < E ? sd->distinct[k] : E;
+    *hits = h;
+    *misses = sd->refs - h;
+    *evictions = *misses - filled;
+}
+
+
+#define RDIST_MIN_CAP (1ul << 16)
+
+rdist_t* initReuseDist(unsigned int b) {
+    rdist_t* rd = (rdist_t*)calloc(1, sizeof(rdist_t));
+    *(unsigned int*)&rd->b = b;
+    rd->cap = RDIST_MIN_CAP;
+    rd->tree = (unsigned int*)calloc(rd->cap + 1, sizeof(unsigned int));
+    blkmapInit(&rd->last, 1 << 12);
+    return rd;
+}
+
+void freeReuseDist(rdist_t* rd) {
+    free(rd->tree);
+    blkmapFree(&rd->last);
+    free(rd);
+}
+
+/* Renumber the latest reference times of the blocks 1..D in the same
+ * order, D being the number of blocks, and rebuild the tree with room
+ * for D more references at least.
+ */
+static void reuseDistCompact(rdist_t* rd) {
+    blkmap_t* map = &rd->last;
+    size_t* slot_at = (size_t*)calloc(rd->clock + 1, sizeof(size_t));
+    unsigned long t = 0;
+
+    for (size_t i = 0; i < map->cap; i++)
+        if (map->keys[i] != CACHE_TAG_NONE)
+            slot_at[map->vals[i]] = i + 1;
+    for (unsigned long time = 1; time <= rd->clock; time++)
+        if (slot_at[time])
+            map->vals[slot_at[time] - 1] = ++t;
+    free(slot_at);
+
+    free(rd->tree);
+    rd->clock = t;
+    rd->cap = 2 * t > RDIST_MIN_CAP ? 2 * t : RDIST_MIN_CAP;
+    rd->tree = (unsigned int*)calloc(rd->cap + 1, sizeof(unsigned int));
+    for (unsigned long i = 1; i <= t; i++)
+        rd->tree[i] = 1;
+    for (unsigned long i = 1; i <= rd->cap; i++) {  // in-place O(n) build
+        unsigned long j = i + (i & -i);
+        if (j <= rd->cap)
+            rd->tree[j] += rd->tree[i];
+    }
+}
+
+/* Record one reference to block `blk`; return its reuse distance, or
+ * RDIST_COLD for the first reference to the block.
+ */
+static unsigned long reuseDistRef(rdist_t* rd, unsigned long blk) {
+    unsigned long* prev;
+    unsigned long now, dist = RDIST_COLD;
+
+    if (rd->clock == rd->cap)
+        reuseDistCompact(rd);
+    now = ++rd->clock;
+    prev = blkmapGet(&rd->last, blk);  // after compacting, which renumbers times
+    ++rd->refs;
+    if (*prev) {
+        /* rd->last.count blocks have a 1 at or before now - 1 */
+        dist = rd->last.count - fenwickSum(rd->tree, *prev);
+        ++rd->hist[dist ? 64 - __builtin_clzl(dist) : 0];
+        fenwickAdd(rd->tree, rd->cap, *prev, -1);
+    }
+    fenwickAdd(rd->tree, rd->cap, now, 1);
+    *prev = now;
+    return dist;
+}
+
+/* Profile one trace access; a modify is a load then a store */
+void reuseDistAccess(rdist_t* rd, const mem_access_t* acc) {
+    unsigned long blk = (acc->addr & ((1ul << MAX_ADDR_BITS) - 1)) >> rd->b;
+    switch (acc->op) {
+        case 'M':
+            reuseDistRef(rd, blk);
+            // fall through
+        case 'L':
+        case 'S':
+            reuseDistRef(rd, blk);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Miss ratio of a fully associative LRU cache of `blocks` blocks, a
+ * power of two, over the references so far; cold misses included.
+ */
+double reuseDistMissRatio(const rdist_t* rd, unsigned long blocks) {
+    unsigned long hits = 0;
+    for (int k = 0; k < RDIST_BINS && (k == 0 || (1ul << (k - 1)) < blocks); k++)
+        hits += rd->hist[k];
+    return rd->refs ? 1.0 - (double)hits / rd->refs : 0.0;
+}
+
+
+/* Set up the classification of the misses of `cache`, an empty cache
+ * whose accesses are then passed to missClassAccess.
+ */
+missclass_t* initMissClass(const cache_t* cache, unsigned int region_bits) {
+    missclass_t* mc = (missclass_t*)calloc(1, sizeof(missclass_t));
+    *(unsigned long*)&mc->blocks = (unsigned long)cache->S * cache->E;
+    *(unsigned int*)&mc->region_bits = region_bits;
+    mc->cap = 16;
+    mc->region = (unsigned long*)malloc(mc->cap * sizeof(unsigned long));
+    mc->counts = calloc(mc->cap, sizeof(*mc->counts));
+    blkmapInit(&mc->region_at, 1 << 6);
+    mc->rd = initReuseDist(cache->b);
+    return mc;
+}
+
+void freeMissClass(missclass_t* mc) {
+    free(mc->region);
+    free(mc->counts);
+    blkmapFree(&mc->region_at);
+    freeReuseDist(mc->rd);
+    free(mc);
+}
+
+/* Classify one reference to `addr`, whose status in the cache was
+ * `status`; every reference goes through the shadow caches.
+ */
+static void missClassRef(missclass_t* mc, unsigned long addr, int status) {
+    unsigned long dist = reuseDistRef(mc->rd, addr >> mc->rd->b);
+    unsigned long* idx;
+    int kind;
+
+    if (status != CACHEBLK_MISS_FREE && status != CACHEBLK_MISS_EVICT)
+        return;
+    if (dist == RDIST_COLD)
+        kind = CACHE_MISS_COMPULSORY;
+    else if (dist >= mc->blocks)
+        kind = CACHE_MISS_CAPACITY;
+    else
+        kind = CACHE_MISS_CONFLICT;
+    ++mc->total[kind];
+
+    idx = blkmapGet(&mc->region_at, addr >> mc->region_bits);
+    if (*idx == 0) {
+        if (mc->nregions == mc->cap) {
+            mc->cap *= 2;
+            mc->region = (unsigned long*)realloc(mc->region, mc->cap * sizeof(unsigned long));
+            mc->counts = realloc(mc->counts, mc->cap * sizeof(*mc->counts));
+        }
+        mc->region[mc->nregions] = addr >> mc->region_bits;
+        memset(mc->counts[mc->nregions], 0, sizeof(*mc->counts));
+        *idx = ++mc->nregions;
+    }
+    ++mc->counts[*idx - 1][kind];
+}
+
+/* Classify the misses of one access, given the statuses cacheAccess
+ * returned for it.
+ */
+void missClassAccess(missclass_t* mc, const mem_access_t* acc, int status_0, int status_1) {
+    unsigned long addr = acc->addr & ((1ul << MAX_ADDR_BITS) - 1);
+    switch (acc->op) {
+        case 'M':
+            missClassRef(mc, addr, status_0);
+            missClassRef(mc, addr, status_1);
+            break;
+        case 'L':
+        case 'S':
+            missClassRef(mc, addr, status_0);
+            break;
+        default:
+            break;
+    }
+}
+
 
 /* 
  * printSummary - Summarize the cache simulation statistics. Student cache simulators
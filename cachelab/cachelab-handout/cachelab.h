@@ -5,6 +5,8 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stddef.h>
+
 #define MAX_TRANS_FUNCS 100
 #define MAX_ADDR_BITS 47
 #define MAX_TRACELINE_LEN 32
@@ -18,6 +20,29 @@
 #define CACHEBLK_MISS_EVICT 1
 #define CACHEBLK_MISS_FREE 2
 
+#define CACHEBLK_VALID 0x1
+#define CACHEBLK_DIRTY 0x2
+#define CACHEBLK_PREFETCHED 0x4  // brought by a prefetch, not used yet
+#define CACHE_TAG_NONE (~0ul)  // tag of an invalid line, never a real tag
+#define CACHE_SIMD_MIN_E 16    // smallest E scanned with AVX2, if the CPU has it
+
+/* Replacement policies. The first four evict the line with the
+ * smallest stamp; the others keep their own state, and evict an
+ * invalid line first if the set has one.
+ */
+#define CACHE_POLICY_LRU       0  // stamp: time of last use
+#define CACHE_POLICY_FIFO      1  // stamp: time of fill
+#define CACHE_POLICY_LFU       2  // stamp: number of uses
+#define CACHE_POLICY_OPT       3  // stamp: the later the next use, the smaller
+#define CACHE_POLICY_RANDOM    4
+#define CACHE_POLICY_TREE_PLRU 5  // E - 1 tree bits per set, E a power of 2
+#define CACHE_POLICY_BIT_PLRU  6  // one MRU bit per way
+#define CACHE_POLICY_SRRIP     7  // stamp: 2-bit re-reference prediction
+#define CACHE_POLICY_BRRIP     8  // SRRIP that mostly inserts at distant
+#define CACHE_NPOLICIES        9
+#define CACHE_PLRU_MAX_E      64  // PLRU bits of a set fit in one word
+#define CACHE_NEXT_NONE (~0u)     // next use of a block never used again
+
 
 typedef struct trans_func {
   void (*func_ptr)(int M,int N,int[N][M],int[M][N]);
@@ -28,22 +53,61 @@ typedef struct trans_func {
   unsigned int num_evictions;
 } trans_func_t;
 
+/* One data access of a valgrind trace; instruction fetches are skipped */
+typedef struct mem_access {
+  unsigned long addr;
+  char op;               // 'L', 'S' or 'M'
+  unsigned short size;   // bytes accessed
+} mem_access_t;
+
 typedef struct addr_id {
   unsigned long tbits;
   unsigned long sbits;
   unsigned long bbits;
 } addr_id_t;
 
-typedef struct cblock {
-  unsigned long tag;
-  char* data;
-  struct cblock* prev;
-  struct cblock* next;
-  int valid;
-  int dirty;
-  int idx; // DEBUGGING
-} cblock_t;
+/* Prefetchers. Both are trained by demand misses and by first uses of
+ * prefetched lines, and fetch `degree` blocks, `distance` blocks ahead.
+ * Next-line fetches the blocks after the one accessed; stream follows
+ * the most recent constant strides, at block granularity, between
+ * nearby accesses, without knowing their instructions.
+ */
+#define CACHE_PF_NONE      0
+#define CACHE_PF_NEXT_LINE 1
+#define CACHE_PF_STREAM    2
+#define CACHE_NPREFETCHERS 3
+#define CACHE_PF_STREAMS  16    // streams tracked at once
+#define CACHE_PF_WINDOW   64    // farthest block of a stream, in blocks
+#define CACHE_PF_FILTER 4096    // victims of prefetches remembered
+
+typedef struct pf_stream {
+  unsigned long last;     // block of the latest access
+  long stride;            // in blocks
+  int conf;               // times the stride was seen again
+  unsigned long used;     // time of the latest access, 0 if free
+} pf_stream_t;
 
+/* Prefetcher state and its counts. A prefetch is useful if its block
+ * is used before it is evicted, late if that use comes within `latency`
+ * demand accesses of the prefetch, useless if evicted unused, and
+ * polluting if the block it evicted misses later on: the filter keeps
+ * the victims of prefetches, hashed by block. Its evictions are counted
+ * here, not in the cache's, which stay those of demand misses.
+ */
+typedef struct prefetch {
+  int kind;               // CACHE_PF_xxx
+  unsigned int degree, distance, latency;
+  unsigned long clock;    // demand accesses so far
+  unsigned long issued, useful, late, useless, polluting, evictions;
+  unsigned long* ready;   // S x E: arrival time of prefetched lines
+  pf_stream_t streams[CACHE_PF_STREAMS];
+  unsigned long filter[CACHE_PF_FILTER];
+} prefetch_t;
+
+/* The lines of all sets live in flat arrays indexed by set * E + way,
+ * so a set is E contiguous tags. LRU order is kept as the time of last
+ * use of each line: the LRU line of a set has the smallest stamp.
+ */
 typedef struct cache {
   const unsigned int E, S, B;
   const unsigned int t, s, b;
@@ -51,26 +115,178 @@ typedef struct cache {
   const unsigned long tmask;
   const unsigned long smask;
   int hits, misses, evictions;
-  cblock_t** blks;
-  cblock_t** heads;  // MRU
-  cblock_t** tails;  // LRU
+  int writebacks;         // evictions of dirty lines
+  int installs;           // blocks placed from above, without a lookup
+  int write_through;      // if set, stores never make a line dirty
+  int write_no_alloc;     // if set, a store miss leaves the set alone
+  unsigned long bytes_read;     // fetched from the next level: fills
+  unsigned long bytes_written;  // sent to the next level: write-backs,
+                                // and stores written through or around
+  unsigned long victim;   // address of the block the last fill evicted
+  int victim_dirty;
+  unsigned long clock;    // accesses so far, the stamp of the next use
+  unsigned long last_set; // set and line of the last access
+  int last_line;
+  int simd;               // scan sets with AVX2: E >= CACHE_SIMD_MIN_E, on a CPU with it
+  unsigned long* tags;    // S x E tags, CACHE_TAG_NONE if invalid
+  int policy;             // CACHE_POLICY_xxx
+  unsigned long rng;      // xorshift state of the random policies
+  unsigned long* plru;    // S PLRU bit vectors, NULL for other policies
+  unsigned long* stamps;  // S x E replacement stamps, 0 if invalid
+  unsigned char* flags;   // S x E CACHEBLK_xxx flags
+  prefetch_t* pf;         // NULL without a prefetcher
+  const unsigned int* next_use;  // OPT: next use of each reference
+  size_t now;             // OPT: references so far, a modify counts twice
 } cache_t;
 
+/* Inclusion of a cache level with respect to the levels above it */
+#define CACHE_NINE      0  // neither inclusive nor exclusive
+#define CACHE_INCLUSIVE 1  // holds every block above it; evicting one
+                           // invalidates it above (back-invalidation)
+#define CACHE_EXCLUSIVE 2  // holds no block above it: filled only with
+                           // victims from above, a hit moves the block up
+#define CACHE_MAX_LEVELS 4
+
+/* A hierarchy of caches, level 0 being the one the trace accesses.
+ * A miss at a level reads the block from the level below, and victims
+ * go down: written back if dirty, or into the level below if it is
+ * exclusive. A write-through level also sends every store below.
+ */
+typedef struct hier {
+  int nlevels;
+  cache_t* levels[CACHE_MAX_LEVELS];
+  int inclusion[CACHE_MAX_LEVELS];  // level 0's is unused
+  unsigned long mem_reads;          // blocks read from memory
+  unsigned long mem_writes;         // blocks written to memory
+} hier_t;
+
+/* Open-addressing map from block number to a time; block numbers are
+ * below 2^MAX_ADDR_BITS, so CACHE_TAG_NONE marks an empty slot.
+ */
+typedef struct blkmap {
+  size_t cap, count;      // cap is a power of two
+  unsigned long* keys;
+  unsigned long* vals;
+} blkmap_t;
+
+/* LRU stack distances of a trace within each set (Mattson et al.).
+ * The distance of a reference is the number of other blocks of its set
+ * used since the last reference to its block, and the reference hits
+ * in an E-way LRU set exactly when that is below E. So one pass gives
+ * the hits of every E at once. Each set counts distinct blocks with a
+ * Fenwick tree over its own reference times, holding a 1 at the latest
+ * reference time of every block.
+ */
+typedef struct stackdist {
+  const unsigned int s, b, dmax;
+  unsigned long refs;       // references so far, a modify counts twice
+  unsigned long* hist;      // hist[d]: references at distance d < dmax
+  unsigned long* distinct;  // S blocks seen per set
+  unsigned long* clock;     // S references so far per set
+  unsigned long* base;      // S + 1 offsets of the per-set trees in `tree`
+  unsigned int* tree;       // per-set Fenwick trees, 1-based
+  blkmap_t last;            // block -> its latest reference time in its set
+} stackdist_t;
+
+/* Reuse distances of a trace at block granularity: the number of
+ * distinct other blocks referenced between two references to a block.
+ * A fully associative LRU cache of C blocks hits exactly the references
+ * at distance below C. Distances are binned by powers of two: bin 0
+ * counts distance 0 and bin k counts distances in [2^(k-1), 2^k).
+ * The Fenwick tree over reference times is compacted when it fills, so
+ * its size follows the number of distinct blocks, not of references.
+ */
+#define RDIST_BINS 48
+
+typedef struct rdist {
+  const unsigned int b;
+  unsigned long refs;              // references so far, a modify counts twice
+  unsigned long hist[RDIST_BINS];  // references per distance bin
+  unsigned long clock;             // latest reference time, at most cap
+  unsigned long cap;               // size of the tree
+  unsigned int* tree;              // Fenwick tree, 1 at a block's latest time
+  blkmap_t last;                   // block -> its latest reference time
+} rdist_t;
+
+/* Three-C classification of the misses of a cache (Hill): compulsory
+ * if the block was never used before, as in an infinite cache; else
+ * capacity if a fully associative LRU cache of the same size would miss
+ * too; else conflict. Both shadow caches are read off reuse distances:
+ * a first reference has no distance, and the fully associative cache
+ * hits exactly the references at distance below its number of blocks.
+ * The counts are also kept per region of 2^region_bits bytes.
+ */
+#define CACHE_MISS_COMPULSORY 0
+#define CACHE_MISS_CAPACITY   1
+#define CACHE_MISS_CONFLICT   2
+#define CACHE_MISS_CLASSES    3
+#define RDIST_COLD (~0ul)  // reuse distance of a first reference
+
+typedef struct missclass {
+  const unsigned long blocks;          // blocks the cache holds
+  const unsigned int region_bits;
+  unsigned long total[CACHE_MISS_CLASSES];
+  size_t nregions, cap;
+  unsigned long* region;               // region number of each region seen
+  unsigned long (*counts)[CACHE_MISS_CLASSES];  // misses of each region
+  blkmap_t region_at;                  // region number -> 1 + its index
+  rdist_t* rd;                         // reuse distances of the blocks
+} missclass_t;
+
 /* Print helper message of the csim program */
 void csimHelper();
 
+/* Trace parsing */
+int parseTraceLine(const char* line, mem_access_t* acc);
+mem_access_t* readTrace(const char* path, size_t* n);
+unsigned int* traceNextUse(const mem_access_t* accs, size_t n, unsigned int b);
+
 /* Methods: cache_t */
 cache_t* initCache(unsigned int E, unsigned int s, unsigned int b);
 void freeCache(cache_t* cache);
 void cacheDecodeAddr(cache_t* cache, unsigned long addr, addr_id_t* id);
-cblock_t* cacheFindBlk(cache_t* cache, unsigned long set, unsigned long tag);
-cblock_t* cacheGetLRU(cache_t* cache, unsigned long set);
-cblock_t* cacheGetMRU(cache_t* cache, unsigned long set);
-void cacheUseBlk(cache_t* cache, unsigned long set, cblock_t* blk, int dirty);
+int cacheFindBlk(cache_t* cache, unsigned long set, unsigned long tag);
+int cacheGetLRU(cache_t* cache, unsigned long set);
+int cacheGetMRU(cache_t* cache, unsigned long set);
+int cacheSetPolicy(cache_t* cache, int policy);
+int cachePolicyByName(const char* name);
+int cacheSetOracle(cache_t* cache, const unsigned int* next_use);
+int cachePrefetcherByName(const char* name);
+int cacheSetPrefetcher(cache_t* cache, int kind, unsigned int degree,
+                       unsigned int distance, unsigned int latency);
+void cacheUseBlk(cache_t* cache, unsigned long set, int line, int dirty);
 
 void cacheStore(cache_t* cache, addr_id_t* id, int* status); /* store to address id */
 void cacheLoad(cache_t* cache, addr_id_t* id, int* status);  /* load from address id */
 void cacheModify(cache_t* cache, addr_id_t* id, int* status_0, int* status_1);
+void cacheAccess(cache_t* cache, const mem_access_t* acc, int* status_0, int* status_1);
+void cachePrefetch(cache_t* cache, const mem_access_t* acc, int status);
+
+/* Methods: hier_t */
+hier_t* initHier(void);
+void freeHier(hier_t* h);
+int hierAddLevel(hier_t* h, unsigned int E, unsigned int s, unsigned int b,
+                 int inclusion, int write_through);
+void hierAccess(hier_t* h, const mem_access_t* acc);
+
+/* Methods: stackdist_t */
+stackdist_t* initStackDist(unsigned int s, unsigned int b, unsigned int dmax,
+                           const mem_access_t* accs, size_t n);
+void freeStackDist(stackdist_t* sd);
+void stackDistAccess(stackdist_t* sd, const mem_access_t* acc);
+void stackDistSummary(stackdist_t* sd, unsigned int E,
+                      unsigned long* hits, unsigned long* misses, unsigned long* evictions);
+
+/* Methods: rdist_t */
+rdist_t* initReuseDist(unsigned int b);
+void freeReuseDist(rdist_t* rd);
+void reuseDistAccess(rdist_t* rd, const mem_access_t* acc);
+double reuseDistMissRatio(const rdist_t* rd, unsigned long blocks);
+
+/* Methods: missclass_t */
+missclass_t* initMissClass(const cache_t* cache, unsigned int region_bits);
+void freeMissClass(missclass_t* mc);
+void missClassAccess(missclass_t* mc, const mem_access_t* acc, int status_0, int status_1);
 
 
 /* 
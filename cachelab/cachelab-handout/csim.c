@@ -1,15 +1,237 @@
+#define _POSIX_C_SOURCE 199309L  // clock_gettime under -std=c99
 #include "cachelab.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+
+/* Replay the accesses of a trace `reps` times on fresh caches and
+ * print the simulated accesses per second of the fastest replay.
+ * Return 3, as the plain simulator does, if the policy cannot run
+ * with E ways.
+ */
+static int benchCache(mem_access_t* accs, size_t n, int reps, int policy,
+                      unsigned int E, unsigned int s, unsigned int b) {
+    struct timespec t0, t1;
+    double secs, best = 0;
+    int status_0, status_1;
+    cache_t* probe = initCache(E, s, b);
+
+    if (cacheSetPolicy(probe, policy) < 0) {
+        printf("./csim: E = %u is not supported by this policy\n", E);
+        freeCache(probe);
+        return 3;
+    }
+    freeCache(probe);
+    for (int r = 0; r < reps; r++) {
+        cache_t* cache = initCache(E, s, b);
+        cacheSetPolicy(cache, policy);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (size_t i = 0; i < n; i++)
+            cacheAccess(cache, &accs[i], &status_0, &status_1);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        if (r == 0 || secs < best)
+            best = secs;
+        if (r == reps - 1)
+            printSummary(cache->hits, cache->misses, cache->evictions);
+        freeCache(cache);
+    }
+    printf("%zu accesses in %.3f s: %.1f M accesses/s (best of %d)\n",
+           n, best, n / best * 1e-6, reps);
+    return 0;
+}
+
+/* Simulate every associativity from 1 to Emax in one pass over the
+ * trace with LRU stack distances, and print the counts of each.
+ */
+static void sweepCache(mem_access_t* accs, size_t n, unsigned int Emax,
+                       unsigned int s, unsigned int b) {
+    unsigned long hits, misses, evictions;
+    stackdist_t* sd = initStackDist(s, b, Emax, accs, n);
+
+    for (size_t i = 0; i < n; i++)
+        stackDistAccess(sd, &accs[i]);
+    for (unsigned int E = 1; E <= Emax; E++) {
+        stackDistSummary(sd, E, &hits, &misses, &evictions);
+        printf("E=%u hits:%lu misses:%lu evictions:%lu\n", E, hits, misses, evictions);
+    }
+    freeStackDist(sd);
+}
+
+/* Simulate Belady's OPT on the trace, next to LRU on the same geometry:
+ * OPT gives the fewest misses any replacement policy could get, so the
+ * gap between the two is all that a better policy, or a reordering of
+ * the accesses within a set, could save.
+ */
+static int optCache(mem_access_t* accs, size_t n,
+                    unsigned int E, unsigned int s, unsigned int b) {
+    int status_0, status_1;
+    unsigned int* next = traceNextUse(accs, n, b);
+    if (next == NULL) {
+        printf("./csim: trace too long for -P opt\n");
+        return 3;
+    }
+
+    cache_t* lru = initCache(E, s, b);
+    cache_t* opt = initCache(E, s, b);
+    cacheSetOracle(opt, next);
+    for (size_t i = 0; i < n; i++) {
+        cacheAccess(lru, &accs[i], &status_0, &status_1);
+        cacheAccess(opt, &accs[i], &status_0, &status_1);
+    }
+    printf("lru hits:%d misses:%d evictions:%d\n", lru->hits, lru->misses, lru->evictions);
+    printSummary(opt->hits, opt->misses, opt->evictions);
+    freeCache(lru);
+    freeCache(opt);
+    free(next);
+    return 0;
+}
+
+/* Apply the write policy token `opt`: wb or wt (write-back or -through),
+ * wa or nwa (write-allocate or not). Return 0 if it is one of them.
+ */
+static int parseWriteOpt(const char* opt, int* write_through, int* write_no_alloc) {
+    if (!strcmp(opt, "wb") || !strcmp(opt, "wt"))
+        *write_through = opt[1] == 't';
+    else if (!strcmp(opt, "wa") || !strcmp(opt, "nwa"))
+        *write_no_alloc = opt[0] == 'n';
+    else
+        return -1;
+    return 0;
+}
+
+static const missclass_t* sort_mc;  // the regions compareRegions orders
+
+static int compareRegions(const void* a, const void* b) {
+    unsigned long ra = sort_mc->region[*(const size_t*)a];
+    unsigned long rb = sort_mc->region[*(const size_t*)b];
+    return ra < rb ? -1 : ra > rb;
+}
+
+/* Print the classes of the misses, in total then per region by address */
+static void printMissClass(const missclass_t* mc) {
+    size_t* order = (size_t*)malloc((mc->nregions + 1) * sizeof(size_t));
+    int width = (MAX_ADDR_BITS + 3) / 4 + 2;
+
+    printf("compulsory:%lu capacity:%lu conflict:%lu\n",
+           mc->total[CACHE_MISS_COMPULSORY], mc->total[CACHE_MISS_CAPACITY],
+           mc->total[CACHE_MISS_CONFLICT]);
+    for (size_t i = 0; i < mc->nregions; i++)
+        order[i] = i;
+    sort_mc = mc;
+    qsort(order, mc->nregions, sizeof(size_t), compareRegions);
+    printf("%-*s %12s %12s %12s\n", width, "region", "compulsory", "capacity", "conflict");
+    for (size_t i = 0; i < mc->nregions; i++) {
+        const unsigned long* counts = mc->counts[order[i]];
+        printf("%#-*lx %12lu %12lu %12lu\n", width, mc->region[order[i]] << mc->region_bits,
+               counts[CACHE_MISS_COMPULSORY], counts[CACHE_MISS_CAPACITY],
+               counts[CACHE_MISS_CONFLICT]);
+    }
+    free(order);
+}
+
+/* Attach the prefetcher described by
+ * "<kind>[:degree[:distance[:latency]]]" to `cache`; return -1 if the
+ * description is malformed. By default a prefetcher fetches one block,
+ * one block (or stride) ahead, and the block arrives 16 accesses later.
+ */
+static int parsePrefetcher(cache_t* cache, const char* desc) {
+    unsigned int degree = 1, distance = 1, latency = 16;
+    char kind[16];
+    int used;
+
+    if (sscanf(desc, "%15[^:]%n", kind, &used) != 1)
+        return -1;
+    if (desc[used] == ':' &&
+        sscanf(&desc[used + 1], "%u:%u:%u", &degree, &distance, &latency) < 1)
+        return -1;
+    return cacheSetPrefetcher(cache, cachePrefetcherByName(kind), degree, distance, latency);
+}
+
+/* Return -1, after naming the first offender, if an option in `given`
+ * (one letter per option on the command line) is not in `allowed`, the
+ * options honoured by the mode `mode`.
+ */
+static int checkModeOpts(const char* given, const char* allowed, const char* mode) {
+    for (; *given; given++) {
+        if (!strchr(allowed, *given)) {
+            printf("./csim: -%c is not supported with %s\n", *given, mode);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Add the level described by
+ * "s:E:b[:inc|:exc][:wb|:wt][:wa|:nwa][:<policy>]" below the levels of
+ * `h`; return -1 if the description is malformed.
+ */
+static int parseLevel(hier_t* h, char* desc) {
+    unsigned int s, E, b;
+    int inclusion = CACHE_NINE, write_through = 0, write_no_alloc = 0, used;
+    int policy = CACHE_POLICY_LRU;
+    char* opt;
+
+    if (sscanf(desc, "%u:%u:%u%n", &s, &E, &b, &used) != 3 || !E ||
+        s + b > MAX_ADDR_BITS)
+        return -1;
+    for (opt = strtok(desc + used, ":"); opt; opt = strtok(NULL, ":")) {
+        if (!strcmp(opt, "inc"))
+            inclusion = CACHE_INCLUSIVE;
+        else if (!strcmp(opt, "exc"))
+            inclusion = CACHE_EXCLUSIVE;
+        else if (parseWriteOpt(opt, &write_through, &write_no_alloc) < 0 &&
+                 (policy = cachePolicyByName(opt)) < 0)
+            return -1;
+    }
+    if (hierAddLevel(h, E, s, b, inclusion, write_through) < 0)
+        return -1;
+    h->levels[h->nlevels - 1]->write_no_alloc = write_no_alloc;
+    return cacheSetPolicy(h->levels[h->nlevels - 1], policy);
+}
+
+/* Run the trace through the hierarchy and print the counts per level */
+static int simulateHier(hier_t* h, const char* trace_path) {
+    FILE* fp;
+    mem_access_t acc;
+    char line_buf[MAX_TRACELINE_LEN];
+
+    if ((fp = fopen(trace_path, "r")) == NULL) {
+        printf("%s: No such file or directory\n", trace_path);
+        return 4;
+    }
+    while (fgets(line_buf, MAX_TRACELINE_LEN, fp))
+        if (parseTraceLine(line_buf, &acc))
+            hierAccess(h, &acc);
+    fclose(fp);
+
+    for (int i = 0; i < h->nlevels; i++) {
+        cache_t* c = h->levels[i];
+        printf("L%d hits:%d misses:%d evictions:%d writebacks:%d installs:%d\n",
+               i + 1, c->hits, c->misses, c->evictions, c->writebacks, c->installs);
+    }
+    printf("mem reads:%lu writes:%lu\n", h->mem_reads, h->mem_writes);
+    return 0;
+}
 
 
 int main(int argc, char* argv[])
 {
     FILE* fp;
-    char* trace_path;
-    int verbose = 0, print_cache = 0;
+    char* trace_path = NULL;
+    int verbose = 0, print_cache = 0, bench_reps = 0;
+    unsigned int sweep_E = 0;
+    int policy = CACHE_POLICY_LRU;
+    int write_through = 0, write_no_alloc = 0;
+    char* prefetcher = NULL;
+    int region_bits = -1;
+    hier_t* hier = initHier();
     unsigned int s = 0, E = 0, b = 0;
+    char given[32] = "";    // the options seen, one letter each
+    const char* mode = NULL;
+    const char* allowed = NULL;
 
     // parsing
     char* arg;
@@ -17,6 +239,8 @@ int main(int argc, char* argv[])
         arg = argv[i];
         if (arg[0] == '-') {
             /* option */
+            if (!strchr(given, arg[1]) && strlen(given) < sizeof(given) - 1)
+                given[strlen(given)] = arg[1];
             switch(arg[1]) {
                 case 'h':
                     csimHelper();
@@ -49,6 +273,47 @@ int main(int argc, char* argv[])
                     if (++i < argc)
                         trace_path = argv[i];
                     break;
+                case 'B':
+                    if (++i < argc)
+                        bench_reps = atoi(argv[i]);
+                    break;
+                case 'A':
+                    if (++i < argc)
+                        E = sweep_E = atoi(argv[i]);
+                    break;
+                case 'P':
+                    if (++i < argc && (policy = cachePolicyByName(argv[i])) < 0) {
+                        printf("./csim: unknown replacement policy -- '%s'\n", argv[i]);
+                        csimHelper();
+                        return 1;
+                    }
+                    break;
+                case 'W':
+                    if (++i < argc) {
+                        for (char* opt = strtok(argv[i], ":"); opt; opt = strtok(NULL, ":")) {
+                            if (parseWriteOpt(opt, &write_through, &write_no_alloc) < 0) {
+                                printf("./csim: unknown write policy -- '%s'\n", opt);
+                                csimHelper();
+                                return 1;
+                            }
+                        }
+                    }
+                    break;
+                case 'C':
+                    if (++i < argc)
+                        region_bits = atoi(argv[i]);
+                    break;
+                case 'F':
+                    if (++i < argc)
+                        prefetcher = argv[i];
+                    break;
+                case 'L':
+                    if (++i < argc && parseLevel(hier, argv[i]) < 0) {
+                        printf("./csim: invalid cache level -- '%s'\n", argv[i]);
+                        csimHelper();
+                        return 1;
+                    }
+                    break;
                 default:
                     printf("./csim: invalid option -- '%s'\n", arg);
                     csimHelper();
@@ -57,53 +322,109 @@ int main(int argc, char* argv[])
         }
     } // parsing done
 
-    // DEBUG
-    printf("[s=%u, E=%u, b=%u, t:%s]\n", s, E, b, trace_path);
+    /* -L, -A, -P opt and -B each run a simulator of their own, which
+     * ignores the options of the others */
+    if (hier->nlevels > 0) {
+        mode = "-L";
+        allowed = "Lt";
+    } else if (sweep_E > 0) {
+        mode = "-A";
+        allowed = "AsbtP";
+    } else if (policy == CACHE_POLICY_OPT) {
+        mode = "-P opt";
+        allowed = "PsEbt";
+    } else if (bench_reps > 0) {
+        mode = "-B";
+        allowed = "BsEbtP";
+    }
+    if (mode && checkModeOpts(given, allowed, mode) < 0) {
+        csimHelper();
+        freeHier(hier);
+        return 2;
+    }
 
-    if ( !(s && E && b && trace_path) ) {
+    if (hier->nlevels > 0 && trace_path) {
+        int ret = simulateHier(hier, trace_path);
+        freeHier(hier);
+        return ret;
+    }
+    freeHier(hier);
+
+    /* s and b may be 0: a fully associative cache, one-byte blocks */
+    if ( !(strchr(given, 's') && E && strchr(given, 'b') && trace_path) ) {
         printf("./csim: Missing required command line argument\n");
         csimHelper();
         return 2;
     }
+
+    // DEBUG
+    printf("[s=%u, E=%u, b=%u, t:%s]\n", s, E, b, trace_path);
     if (s > MAX_ADDR_BITS || b > MAX_ADDR_BITS || (s + b) > MAX_ADDR_BITS) {
         printf("./csim: Invalid cache parameters (s = %u, b = %u)\n", s, b);
         return 3;
     }
+    if (sweep_E > 0 && policy != CACHE_POLICY_LRU) {
+        printf("./csim: -A simulates LRU caches only\n");
+        return 2;
+    }
+    if (bench_reps > 0 || sweep_E > 0 || policy == CACHE_POLICY_OPT) {
+        size_t n;
+        int ret = 0;
+        mem_access_t* accs = readTrace(trace_path, &n);
+        if (accs == NULL) {
+            printf("%s: No such file or directory\n", trace_path);
+            return 4;
+        }
+        if (sweep_E > 0)
+            sweepCache(accs, n, sweep_E, s, b);
+        else if (policy == CACHE_POLICY_OPT)
+            ret = optCache(accs, n, E, s, b);
+        else
+            ret = benchCache(accs, n, bench_reps, policy, E, s, b);
+        free(accs);
+        return ret;
+    }
     if ( (fp = fopen(trace_path, "r")) == NULL ) {
         printf("%s: No such file or directory\n", trace_path);
         return 4;
     }
 
-    unsigned long addr;
-    addr_id_t id;
+    mem_access_t acc;
     cache_t* cache = initCache(E, s, b);
+    if (cacheSetPolicy(cache, policy) < 0) {
+        printf("./csim: E = %u is not supported by this policy\n", E);
+        freeCache(cache);
+        fclose(fp);
+        return 3;
+    }
+    cache->write_through = write_through;
+    cache->write_no_alloc = write_no_alloc;
+    if (prefetcher && parsePrefetcher(cache, prefetcher) < 0) {
+        printf("./csim: invalid prefetcher -- '%s'\n", prefetcher);
+        csimHelper();
+        freeCache(cache);
+        fclose(fp);
+        return 1;
+    }
+    if (region_bits > MAX_ADDR_BITS) {
+        printf("./csim: Invalid region size (%d bits)\n", region_bits);
+        freeCache(cache);
+        fclose(fp);
+        return 3;
+    }
+    missclass_t* mc = region_bits >= 0 ? initMissClass(cache, region_bits) : NULL;
     int status_0 = CACHEBLK_NIL;
     int status_1 = CACHEBLK_NIL;
 
-    char* end_p;
     char line_buf[MAX_TRACELINE_LEN];
     while (fgets(line_buf, MAX_TRACELINE_LEN, fp)) {
-        if (line_buf[0] != ' ')
+        if (!parseTraceLine(line_buf, &acc))
             continue;
-
-        end_p = &line_buf[strcspn(line_buf, ",")];
-        addr  = strtoul(&line_buf[3], &end_p, 16);
-        cacheDecodeAddr(cache, addr, &id);
-        status_1 = CACHEBLK_NIL;
-
-        switch (line_buf[1]) {
-            case 'S':
-                cacheStore(cache, &id, &status_0);
-                break;
-            case 'L':
-                cacheLoad(cache, &id, &status_0);
-                break;
-            case 'M':
-                cacheModify(cache, &id, &status_0, &status_1);
-                break;
-            default:
-                break;
-        }
+        cacheAccess(cache, &acc, &status_0, &status_1);
+        if (cache->pf)
+            cachePrefetch(cache, &acc, status_0);
+        if (mc)
+            missClassAccess(mc, &acc, status_0, status_1);
 
         if (verbose) {
             /* print trace */
@@ -146,22 +467,33 @@ int main(int argc, char* argv[])
                         "Cache set %d/%d (MRU=%d , LRU=%d):\n",
                         i, 
                         cache->S - 1, 
-                        cacheGetMRU(cache, i)->idx, 
-                        cacheGetLRU(cache, i)->idx
+                        cacheGetMRU(cache, i) - i * cache->E, 
+                        cacheGetLRU(cache, i) - i * cache->E
                     );
-                    cblock_t* blk = cache->blks[i];
-                    for (int j = 0; j < cache->E; j++, blk++) {
+                    for (int j = 0; j < cache->E; j++) {
+                        int line = i * cache->E + j;
                         printf("- blk %d/%d:\t", j, cache->E - 1);
-                        printf("v=%d | ", blk->valid);
-                        printf("d=%d | ", blk->dirty);
-                        printf("tag=%0*lx\n", (int)((MAX_ADDR_BITS - (s+b) + 3) / 4), blk->tag);
+                        printf("v=%d | ", !!(cache->flags[line] & CACHEBLK_VALID));
+                        printf("d=%d | ", !!(cache->flags[line] & CACHEBLK_DIRTY));
+                        printf("tag=%0*lx\n", (int)((MAX_ADDR_BITS - (s+b) + 3) / 4),
+                               cache->flags[line] & CACHEBLK_VALID ? cache->tags[line] : 0ul);
                     }
                 }
             }
         }
     }
     fclose(fp);
-    freeCache(cache);
+    if (mc) {
+        printMissClass(mc);
+        freeMissClass(mc);
+    }
+    if (cache->pf)
+        printf("prefetches:%lu useful:%lu late:%lu useless:%lu polluting:%lu evictions:%lu\n",
+               cache->pf->issued, cache->pf->useful, cache->pf->late,
+               cache->pf->useless, cache->pf->polluting, cache->pf->evictions);
+    printf("writebacks:%d bytes read:%lu written:%lu\n",
+           cache->writebacks, cache->bytes_read, cache->bytes_written);
     printSummary(cache->hits, cache->misses, cache->evictions);
+    freeCache(cache);
     return 0;
 }
@@ -0,0 +1,115 @@
+/*
+ * rdist.c - Reuse-distance profile of a valgrind memory trace.
+ *
+ * Prints the reuse distances of the trace at block granularity, binned
+ * by powers of two, and the miss-ratio curve they give for fully
+ * associative LRU caches of 1 up to 2^k blocks. Unlike csim, the result
+ * does not depend on a cache geometry. The trace is streamed, so the
+ * memory used grows with the number of distinct blocks only.
+ */
+#include "cachelab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void rdistHelper() {
+    puts(
+        "Usage: ./rdist [-h] -b <num> -t <file>\n"
+        "Options:\n"
+        "  -h         Print this help message.\n"
+        "  -b <num>   Number of block offset bits.\n"
+        "  -t <file>  Trace file.\n"
+        "\n"
+        "Examples:\n"
+        "  linux>  ./rdist -b 5 -t traces/trans.trace"
+    );
+}
+
+int main(int argc, char* argv[])
+{
+    FILE* fp;
+    char* trace_path = NULL;
+    int b = -1;
+
+    // parsing
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-')
+            continue;
+        switch (argv[i][1]) {
+            case 'h':
+                rdistHelper();
+                return 0;
+            case 'b':
+                if (++i < argc)
+                    b = atoi(argv[i]);
+                break;
+            case 't':
+                if (++i < argc)
+                    trace_path = argv[i];
+                break;
+            default:
+                printf("./rdist: invalid option -- '%s'\n", argv[i]);
+                rdistHelper();
+                return 1;
+        }
+    } // parsing done
+
+    if (b < 0 || !trace_path) {
+        printf("./rdist: Missing required command line argument\n");
+        rdistHelper();
+        return 2;
+    }
+    if (b > MAX_ADDR_BITS) {
+        printf("./rdist: Invalid block size (b = %d)\n", b);
+        return 3;
+    }
+    if ((fp = fopen(trace_path, "r")) == NULL) {
+        printf("%s: No such file or directory\n", trace_path);
+        return 4;
+    }
+
+    mem_access_t acc;
+    rdist_t* rd = initReuseDist(b);
+    char line_buf[MAX_TRACELINE_LEN];
+    while (fgets(line_buf, MAX_TRACELINE_LEN, fp))
+        if (parseTraceLine(line_buf, &acc))
+            reuseDistAccess(rd, &acc);
+    fclose(fp);
+
+    unsigned long blocks = rd->last.count;
+    unsigned long reuses = rd->refs - blocks;
+    int top = RDIST_BINS - 1;
+    while (top > 0 && rd->hist[top] == 0)
+        top--;
+
+    printf("references:%lu blocks:%lu (%lu bytes)\n",
+           rd->refs, blocks, blocks << b);
+    printf("\n%-22s %12s %7s %7s\n", "distance", "references", "%", "cum%");
+    unsigned long cum = 0;
+    for (int k = 0; k <= top; k++) {
+        char range[48];
+        cum += rd->hist[k];
+        if (k == 0)
+            snprintf(range, sizeof(range), "0");
+        else
+            snprintf(range, sizeof(range), "[%lu, %lu)", 1ul << (k - 1), 1ul << k);
+        printf("%-22s %12lu %7.2f %7.2f\n", range, rd->hist[k],
+               100.0 * rd->hist[k] / rd->refs, 100.0 * cum / rd->refs);
+    }
+    printf("%-22s %12lu %7.2f %7.2f\n", "cold", blocks,
+           100.0 * blocks / rd->refs, 100.0 * (cum + blocks) / rd->refs);
+
+    /* Miss-ratio curve, until the cache holds every block */
+    printf("\n%12s %14s %10s\n", "blocks", "bytes", "miss ratio");
+    for (int k = 0; k <= top; k++) {
+        unsigned long size = 1ul << k;
+        printf("%12lu %14lu %10.4f\n", size, size << b,
+               reuseDistMissRatio(rd, size));
+    }
+    if (reuses == 0)
+        printf("(no block is referenced twice)\n");
+
+    freeReuseDist(rd);
+    return 0;
+}
@@ -34,6 +34,38 @@
   "realloc-bal.rep",\
   "realloc2-bal.rep"
 
+/*
+ * The extended suite (mdriver -E): traces captured from real programs.
+ * They are not balanced, so blocks left allocated at the end are leaks
+ * rather than errors; some also realloc or free an id before it is
+ * allocated, which stands for realloc(NULL, n) and free(NULL).
+ * alaska.rep is left out: most of its allocate requests have no size.
+ */
+#define EXTENDED_TRACEFILES \
+  "boat.rep",\
+  "freeciv.rep",\
+  "fs.rep",\
+  "hostname.rep",\
+  "login.rep",\
+  "ls.rep",\
+  "mutt.rep",\
+  "perl.rep",\
+  "rm.rep",\
+  "stty.rep",\
+  "tty.rep",\
+  "xterm.rep"
+
+/*
+ * Traces followed by mdriver -R to watch the resident memory of the
+ * heap over time: two small real programs, and two balanced traces
+ * whose heap climbs to a few MB and then drops to nothing.
+ */
+#define RSS_TRACEFILES \
+  "ls.rep",\
+  "perl.rep",\
+  "cp-decl-bal.rep",\
+  "expr-bal.rep"
+
 /*
  * This constant gives the estimated performance of the libc malloc
  * package using our traces on some reference system, typically the
@@ -62,11 +94,17 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/* 
+ * Huge page size used when the heap is backed by huge pages (-P)
+ */
+#define HUGEPAGE_SIZE (1<<21)  /* 2 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_FBENCH 0   /* median of repeated runs w/warm-up (any Unix box) */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,239 @@
+/*
+ * fbench.c - Benchmark a function f with repeated runs
+ *
+ * Unlike the K-best scheme in fcyc.c, which reports the fastest run
+ * and stops as soon as a few runs agree, fbench times a fixed number
+ * of runs after some warm-up runs (to settle the caches, the page
+ * tables and the clock frequency) and keeps all of them. The result
+ * is summarized by the median and the median absolute deviation,
+ * which are not thrown off by the odd run that got interrupted, and
+ * by a percentile bootstrap confidence interval for the median. The
+ * same resampling is used to decide whether two builds differ.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fbench.h"
+
+/* Default values */
+#define WARMUP 3             /* Untimed runs before measuring */
+#define ITERS 31             /* Timed runs */
+#define CONFIDENCE 0.95      /* Level of the confidence intervals */
+#define RESAMPLES 2000       /* Bootstrap resamples per interval */
+#define THRESHOLD 0.02       /* Smallest relative change worth reporting */
+
+static int warmup = WARMUP;
+static int iters = ITERS;
+static double confidence = CONFIDENCE;
+static double threshold = THRESHOLD;
+
+/* xorshift64 state; fixed seed so intervals are reproducible */
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+/*
+ * rng - Return a pseudo-random integer in [0, n)
+ */
+static int rng(int n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (int)(rng_state % n);
+}
+
+/*
+ * now - Return a monotonic time stamp in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * median - Return the median of the n values in v, sorting v
+ */
+static double median(double *v, int n)
+{
+    qsort(v, n, sizeof(double), cmp_double);
+    return (n % 2) ? v[n/2] : (v[n/2-1] + v[n/2]) / 2;
+}
+
+/*
+ * resample_median - Return the median of n values drawn with
+ *     replacement from v, using tmp as scratch space
+ */
+static double resample_median(double *v, int n, double *tmp)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	tmp[i] = v[rng(n)];
+    return median(tmp, n);
+}
+
+/*
+ * bootstrap - Compute the percentile bootstrap interval [lo, hi] of
+ *     median(x)/median(base) - 1, or of median(x) if base is NULL.
+ *     Returns -1 if out of memory.
+ */
+static int bootstrap(double *base, int nbase, double *x, int nx, 
+		     double *lo, double *hi)
+{
+    double *stats, *tmp;
+    int i, n = nx > nbase ? nx : nbase;
+    double tail = (1 - confidence) / 2;
+
+    stats = malloc(RESAMPLES * sizeof(double));
+    tmp = malloc(n * sizeof(double));
+    if (stats == NULL || tmp == NULL) {
+	free(stats);
+	free(tmp);
+	return -1;
+    }
+    for (i = 0; i < RESAMPLES; i++) {
+	stats[i] = resample_median(x, nx, tmp);
+	if (base != NULL)
+	    stats[i] = stats[i] / resample_median(base, nbase, tmp) - 1;
+    }
+    qsort(stats, RESAMPLES, sizeof(double), cmp_double);
+    *lo = stats[(int)(tail * (RESAMPLES - 1))];
+    *hi = stats[(int)((1 - tail) * (RESAMPLES - 1))];
+    free(stats);
+    free(tmp);
+    return 0;
+}
+
+/* 
+ * fbench - Time iters runs of f(argp) after warmup untimed runs
+ */
+int fbench(fbench_test_funct f, void *argp, fbench_t *res)
+{
+    double start, *dev;
+    int i;
+
+    res->n = 0;
+    if ((res->samples = malloc(iters * sizeof(double))) == NULL)
+	return -1;
+    res->n = iters;
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < iters; i++) {
+	start = now();
+	f(argp);
+	res->samples[i] = now() - start;
+    }
+
+    res->median = median(res->samples, iters);
+    if ((dev = malloc(iters * sizeof(double))) == NULL) {
+	fbench_free(res);
+	return -1;
+    }
+    for (i = 0; i < iters; i++)
+	dev[i] = res->samples[i] > res->median ? 
+	    res->samples[i] - res->median : res->median - res->samples[i];
+    res->mad = median(dev, iters);
+    free(dev);
+    if (bootstrap(NULL, 0, res->samples, iters, &res->lo, &res->hi) < 0) {
+	fbench_free(res);
+	return -1;
+    }
+    return 0;
+}
+
+/* 
+ * fbench_free - Release the samples of res
+ */
+void fbench_free(fbench_t *res)
+{
+    free(res->samples);
+    res->samples = NULL;
+    res->n = 0;
+}
+
+/* 
+ * fbench_compare - Decide whether x differs from base. The difference
+ *     is significant when the interval of the relative change of the
+ *     medians lies entirely beyond the threshold. The threshold absorbs
+ *     the run-to-run drift (code layout, clock frequency) that no
+ *     amount of sampling within one run can remove.
+ */
+int fbench_compare(double *base, int nbase, double *x, int nx, 
+		   double *lo, double *hi)
+{
+    if (bootstrap(base, nbase, x, nx, lo, hi) < 0)
+	return 0;
+    if (*lo > threshold)
+	return 1;
+    if (*hi < -threshold)
+	return -1;
+    return 0;
+}
+
+
+/*************************************************************
+ * Set the various parameters used by fbench
+ ************************************************************/
+
+/* 
+ * set_fbench_warmup - Number of untimed runs before the timed ones
+ *     Default = 3
+ */
+void set_fbench_warmup(int runs)
+{
+    warmup = runs;
+}
+
+/* 
+ * set_fbench_iters - Number of timed runs
+ *     Default = 31
+ */
+void set_fbench_iters(int n)
+{
+    iters = n > 0 ? n : 1;
+}
+
+/* 
+ * set_fbench_cpu - Pin the calling process to CPU cpu
+ *     Default = not pinned
+ */
+int set_fbench_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* 
+ * set_fbench_confidence - Confidence level of the bootstrap intervals
+ *     Default = 0.95
+ */
+void set_fbench_confidence(double level)
+{
+    confidence = level;
+}
+
+/* 
+ * set_fbench_threshold - Smallest relative change fbench_compare
+ *     reports as significant
+ *     Default = 0.02
+ */
+void set_fbench_threshold(double change)
+{
+    threshold = change;
+}
@@ -0,0 +1,74 @@
+/*
+ * fbench.h - Repeated-run benchmarking of a test function f with
+ *     robust statistics
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*fbench_test_funct)(void *);
+
+/* Summary of the timed runs of one test function */
+typedef struct {
+    int n;            /* number of timed runs */
+    double *samples;  /* running time of each run in seconds, sorted */
+    double median;    /* median running time */
+    double mad;       /* median absolute deviation from the median */
+    double lo, hi;    /* bootstrap confidence interval of the median */
+} fbench_t;
+
+/* 
+ * fbench - Run f(argp) for the warm-up runs, then time the configured
+ *     number of runs and summarize them in res. Returns 0, or -1 if
+ *     memory ran out; res then holds no samples to free.
+ */
+int fbench(fbench_test_funct f, void *argp, fbench_t *res);
+
+/* fbench_free - Release the samples of res */
+void fbench_free(fbench_t *res);
+
+/*
+ * fbench_compare - Compare the samples x of a new build against the
+ *     samples base of an old one. Stores the bootstrap confidence
+ *     interval of the relative change of the median running time
+ *     (x/base - 1) in lo and hi. Returns 1 if x is significantly
+ *     slower, -1 if it is significantly faster and 0 otherwise. A
+ *     change is significant if the whole interval is beyond the
+ *     threshold.
+ */
+int fbench_compare(double *base, int nbase, double *x, int nx, 
+		   double *lo, double *hi);
+
+/*********************************************************
+ * Set the various parameters used by fbench
+ *********************************************************/
+
+/* 
+ * set_fbench_warmup - Number of untimed runs before the timed ones
+ *     Default = 3
+ */
+void set_fbench_warmup(int runs);
+
+/* 
+ * set_fbench_iters - Number of timed runs
+ *     Default = 31
+ */
+void set_fbench_iters(int iters);
+
+/* 
+ * set_fbench_cpu - Pin the calling process to CPU cpu, so all runs
+ *     see the same core and caches. Returns 0, or -1 on failure.
+ *     Default = not pinned
+ */
+int set_fbench_cpu(int cpu);
+
+/* 
+ * set_fbench_confidence - Confidence level of the bootstrap intervals
+ *     Default = 0.95
+ */
+void set_fbench_confidence(double level);
+
+/* 
+ * set_fbench_threshold - Smallest relative change fbench_compare
+ *     reports as significant
+ *     Default = 0.02
+ */
+void set_fbench_threshold(double change);
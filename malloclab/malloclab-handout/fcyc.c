@@ -6,10 +6,26 @@
  *
  * Uses the cycle timer routines in clock.c to estimate the
  * the time in CPU cycles for a function f.
+ *
+ * By default a sample is one run of f in whatever state the caches
+ * were left in. Three cache states can be asked for instead. A cold
+ * sample flushes the caches first, either with clflush on the regions
+ * the caller registered or by reading a buffer twice the size of the
+ * last level cache; both sizes come from sysfs. A warm sample flushes
+ * and then runs f once untimed, so exactly f's own working set is
+ * cached. A steady-state sample averages several back-to-back runs.
  */
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define HAVE_CLFLUSH 1
+#else
+#define HAVE_CLFLUSH 0
+#endif
 
 #include "fcyc.h"
 #include "clock.h"
@@ -19,20 +35,31 @@
 #define MAXSAMPLES 20        /* Give up after MAXSAMPLES */
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
-#define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define MODE FCYC_NONE       /* Cache state to run the test function in */
+#define CACHE_BYTES (1<<19)  /* Cache size in bytes if sysfs has none */
+#define CACHE_BLOCK 32       /* Cache block size in bytes if sysfs has none */
+#define EVICT_FACTOR 2       /* Size of the eviction buffer in LLC sizes */
+#define STEADY_RUNS 8        /* Back-to-back runs per steady-state sample */
+#define MAXREGIONS 8         /* Max number of regions to clflush */
+#define SYSFS_CACHE "/sys/devices/system/cpu/cpu0/cache"
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
 static double epsilon = EPSILON;
 static int compensate = COMPENSATE;
-static int clear_cache = CLEAR_CACHE;
-static int cache_bytes = CACHE_BYTES;
-static int cache_block = CACHE_BLOCK;
+static int mode = MODE;
+static int cache_bytes = 0;  /* 0 until set or read from sysfs */
+static int cache_block = 0;  /* ditto */
 
 static int *cache_buf = NULL;
 
+/* Regions flushed with clflush instead of reading the buffer */
+static struct {
+    char *p;
+    size_t len;
+} regions[MAXREGIONS];
+static int nregions = 0;
+
 static double *values = NULL;
 static int samplecount = 0;
 
@@ -97,6 +124,77 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*
+ * read_sysfs - Read the number in file name of cpu0's cache index,
+ *     scaled by its K or M suffix. Returns -1 if there is none.
+ */
+static long read_sysfs(int index, char *name)
+{
+    char path[256];
+    FILE *fp;
+    long val;
+    char unit = 0;
+
+    sprintf(path, "%s/index%d/%s", SYSFS_CACHE, index, name);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    if (fscanf(fp, "%ld%c", &val, &unit) < 1)
+	val = -1;
+    fclose(fp);
+    if (unit == 'K')
+	val <<= 10;
+    else if (unit == 'M')
+	val <<= 20;
+    return val;
+}
+
+/*
+ * get_fcyc_cache_size - Return the size in bytes of the data or unified
+ *     cache at the given level (0 = last level), or 0 if sysfs doesn't
+ *     list it. Its line size is stored in *line unless line is NULL.
+ */
+int get_fcyc_cache_size(int level, int *line)
+{
+    char path[256], type[32];
+    FILE *fp;
+    int i;
+    long lvl, maxlvl = 0, size = 0, lsize = 0;
+
+    for (i = 0; (lvl = read_sysfs(i, "level")) > 0; i++) {
+	sprintf(path, "%s/index%d/type", SYSFS_CACHE, i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	if (fscanf(fp, "%31s", type) != 1)
+	    type[0] = '\0';
+	fclose(fp);
+	if (!strcmp(type, "Instruction"))
+	    continue;
+	if (lvl == level || (level == 0 && lvl >= maxlvl)) {
+	    maxlvl = lvl;
+	    size = read_sysfs(i, "size");
+	    lsize = read_sysfs(i, "coherency_line_size");
+	}
+    }
+    if (line != NULL)
+	*line = lsize > 0 ? lsize : 0;
+    return size > 0 ? size : 0;
+}
+
+/*
+ * init_cache_params - Size the eviction buffer and the flush stride
+ *     from sysfs unless the caller already set them
+ */
+static void init_cache_params()
+{
+    int llc, line;
+
+    llc = get_fcyc_cache_size(0, &line);
+    if (cache_bytes == 0)
+	cache_bytes = llc ? EVICT_FACTOR * llc : CACHE_BYTES;
+    if (cache_block == 0)
+	cache_block = line ? line : CACHE_BLOCK;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -106,13 +204,31 @@ static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    int incr;
+
+    if (cache_bytes == 0 || cache_block == 0)
+	init_cache_params();
+#if HAVE_CLFLUSH
+    if (nregions > 0) {
+	int i;
+	char *p;
+	for (i = 0; i < nregions; i++)
+	    for (p = regions[i].p - (size_t)regions[i].p % cache_block;
+		 p < regions[i].p + regions[i].len; p += cache_block)
+		_mm_clflush(p);  /* from the line holding the first byte */
+	_mm_mfence();
+	return;
+    }
+#endif
+    incr = cache_block/sizeof(int);
     if (!cache_buf) {
 	cache_buf = malloc(cache_bytes);
 	if (!cache_buf) {
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Give every page its own frame; untouched pages share one */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -123,6 +239,28 @@ static void clear()
     sink = x;
 }
 
+/*
+ * sample - Measure the cycles of one run of f in the current mode
+ */
+static double sample(test_funct f, void *argp)
+{
+    int i, runs = (mode == FCYC_STEADY) ? STEADY_RUNS : 1;
+    double cyc;
+
+    if (mode == FCYC_COLD || mode == FCYC_WARM)
+	clear();
+    if (mode == FCYC_WARM)
+	f(argp);
+    if (compensate)
+	start_comp_counter();
+    else
+	start_counter();
+    for (i = 0; i < runs; i++)
+	f(argp);
+    cyc = compensate ? get_comp_counter() : get_counter();
+    return cyc / runs;
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
@@ -130,27 +268,9 @@ double fcyc(test_funct f, void *argp)
 {
     double result;
     init_sampler();
-    if (compensate) {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_comp_counter();
-	    f(argp);
-	    cyc = get_comp_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    } else {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_counter();
-	    f(argp);
-	    cyc = get_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
-    }
+    do {
+	add_sample(sample(f, argp));
+    } while (!has_converged() && samplecount < maxsamples);
 #ifdef DEBUG
     {
 	int i;
@@ -174,17 +294,54 @@ double fcyc(test_funct f, void *argp)
 
 /* 
  * set_fcyc_clear_cache - When set, will run code to clear cache 
- *     before each measurement. 
+ *     before each measurement. Same as set_fcyc_mode(FCYC_COLD),
+ *     or set_fcyc_mode(FCYC_NONE) when cleared.
  *     Default = 0
  */
 void set_fcyc_clear_cache(int clear)
 {
-    clear_cache = clear;
+    mode = clear ? FCYC_COLD : FCYC_NONE;
+}
+
+/* 
+ * set_fcyc_mode - Cache state each measurement starts in. Returns
+ *     the previous one, for callers to restore.
+ *     Default = FCYC_NONE
+ */
+int set_fcyc_mode(int mode_arg)
+{
+    int old = mode;
+
+    mode = mode_arg;
+    return old;
+}
+
+/* 
+ * add_fcyc_flush_region - Flush len bytes at p with clflush when
+ *     clearing the cache, instead of reading the eviction buffer. 
+ *     Returns -1 if there is no room for another region.
+ */
+int add_fcyc_flush_region(void *p, size_t len)
+{
+    if (nregions == MAXREGIONS)
+	return -1;
+    regions[nregions].p = p;
+    regions[nregions].len = len;
+    nregions++;
+    return 0;
+}
+
+/* 
+ * reset_fcyc_flush_regions - Forget all clflush regions
+ */
+void reset_fcyc_flush_regions(void)
+{
+    nregions = 0;
 }
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = twice the last level cache size in sysfs, else 1<<19
  */
 void set_fcyc_cache_size(int bytes)
 {
@@ -199,7 +356,7 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size in sysfs, else 32
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
@@ -7,9 +7,17 @@
  *
  */
 
+#include <stddef.h>
+
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
+/* Cache states a measurement can start in (set_fcyc_mode) */
+#define FCYC_COLD   0  /* caches flushed */
+#define FCYC_WARM   1  /* flushed, then one untimed run of f */
+#define FCYC_STEADY 2  /* averaged over back-to-back runs of f */
+#define FCYC_NONE   3  /* one run, caches as left (the default) */
+
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
@@ -19,20 +27,47 @@ double fcyc(test_funct f, void* argp);
 
 /* 
  * set_fcyc_clear_cache - When set, will run code to clear cache 
- *     before each measurement. 
+ *     before each measurement. Same as set_fcyc_mode(FCYC_COLD),
+ *     or set_fcyc_mode(FCYC_NONE) when cleared.
  *     Default = 0
  */
 void set_fcyc_clear_cache(int clear);
 
+/* 
+ * set_fcyc_mode - Cache state each measurement starts in. Returns
+ *     the previous one, for callers to restore.
+ *     Default = FCYC_NONE
+ */
+int set_fcyc_mode(int mode);
+
+/* 
+ * add_fcyc_flush_region - Flush len bytes at p with clflush when
+ *     clearing the cache, instead of reading the eviction buffer
+ *     (x86 only). Returns -1 if there is no room for another region.
+ */
+int add_fcyc_flush_region(void *p, size_t len);
+
+/* 
+ * reset_fcyc_flush_regions - Forget all clflush regions
+ */
+void reset_fcyc_flush_regions(void);
+
+/* 
+ * get_fcyc_cache_size - Size in bytes of the data or unified cache at
+ *     the given level (0 = last level) according to sysfs, or 0. Its
+ *     line size is stored in *line unless line is NULL.
+ */
+int get_fcyc_cache_size(int level, int *line);
+
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = twice the last level cache size in sysfs, else 1<<19
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = line size in sysfs, else 32
  */
 void set_fcyc_cache_block(int bytes);
 
@@ -0,0 +1,92 @@
+/*
+ * fperf.c - Count hardware events used by a function f
+ *
+ * Every event is opened as its own counter, so the kernel can
+ * multiplex them when the PMU has fewer counters than events; counts
+ * are scaled by the fraction of time each counter was actually
+ * running. All counters of the process are switched on and off
+ * together around f with prctl. Counting is restricted to user mode,
+ * which also works with the default kernel.perf_event_paranoid
+ * setting of 2.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fperf.h"
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* Type and config of each event, in FPERF_xxx order */
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} events[FPERF_NEVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+const char *fperf_names[FPERF_NEVENTS] = {
+    "cycles", "instrs", "L1d", "LLC", "branch", "dTLB",
+};
+
+/*
+ * open_event - Open a disabled counter for event i. Returns the file
+ *     descriptor or -1.
+ */
+static int open_event(int i)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.enable_on_exec = 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* 
+ * fperf - Run f(argp) once, counting each of the FPERF_xxx events
+ */
+int fperf(fperf_test_funct f, void *argp, long long counts[FPERF_NEVENTS])
+{
+    int fds[FPERF_NEVENTS];
+    int i, nopen = 0;
+    unsigned long long val[3];  /* value, time enabled, time running */
+
+    for (i = 0; i < FPERF_NEVENTS; i++) {
+	if ((fds[i] = open_event(i)) != -1)
+	    nopen++;
+	counts[i] = -1;
+    }
+    if (nopen == 0)
+	return -1;
+
+    prctl(PR_TASK_PERF_EVENTS_ENABLE);
+    f(argp);
+    prctl(PR_TASK_PERF_EVENTS_DISABLE);
+
+    for (i = 0; i < FPERF_NEVENTS; i++) {
+	if (fds[i] == -1)
+	    continue;
+	if (read(fds[i], val, sizeof(val)) == sizeof(val) && val[2] > 0)
+	    counts[i] = (long long)((double)val[0] * val[1] / val[2]);
+	close(fds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * fperf.h - Count hardware events used by a test function f, using the
+ *     Linux perf_event_open interface
+ */
+
+/* The test function takes a generic pointer as input */
+typedef void (*fperf_test_funct)(void *);
+
+/* Events counted by fperf, indices into its counts array */
+#define FPERF_CYCLES        0  /* CPU cycles */
+#define FPERF_INSTRUCTIONS  1  /* instructions retired */
+#define FPERF_L1D_MISSES    2  /* L1 data cache load misses */
+#define FPERF_LLC_MISSES    3  /* last level cache misses */
+#define FPERF_BRANCH_MISSES 4  /* mispredicted branches */
+#define FPERF_DTLB_MISSES   5  /* data TLB load misses */
+#define FPERF_NEVENTS       6
+
+/* Short names of the events, for table headers */
+extern const char *fperf_names[FPERF_NEVENTS];
+
+/* 
+ * fperf - Run f(argp) once and store the user-mode event counts in
+ *     counts. An event the CPU or kernel can't count is set to -1. 
+ *     Returns 0, or -1 if no event could be counted at all.
+ */
+int fperf(fperf_test_funct f, void *argp, long long counts[FPERF_NEVENTS]);
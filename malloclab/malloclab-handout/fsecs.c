@@ -2,10 +2,12 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fbench.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
@@ -36,6 +38,9 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_FBENCH
+    if (verbose)
+	printf("Measuring performance with the median of repeated runs.\n");
 #endif
 }
 
@@ -51,6 +56,17 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_FBENCH
+    fbench_t res;
+    double secs;
+
+    if (fbench(f, argp, &res) < 0) {
+	fprintf(stderr, "Fatal error.  fbench ran out of memory\n");
+	exit(1);
+    }
+    secs = res.median;
+    fbench_free(&res);
+    return secs;
 #endif 
 }
 
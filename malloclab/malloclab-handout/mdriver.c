@@ -15,10 +15,17 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <signal.h>
 
 #include "mm.h"
+#include "mmh.h"
+#include "mmpool.h"
+#include "mmprof.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fperf.h"
+#include "fbench.h"
+#include "fcyc.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +36,21 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define GC_SAMPLES    10 /* number of collections per trace with -G */
+#define HBUDGET     4096 /* bytes the compactor may move per request (-H) */
+#define PROFFILE "mm.prof" /* where the heap profile is written (-p) */
+#define BENCHFILE "mm-bench.json" /* where benchmark samples go (-B) */
+#define BENCH_ITERS   31 /* default number of timed runs with -X */
+#define LOOKUP_MAX (1<<20) /* largest request size checked by -L */
+#define LOOKUP_REPS  100 /* passes over the request sizes per timed run */
+#define POOL_OBJS 100000 /* objects allocated per timed run with -O */
+#define RSS_SAMPLES   20 /* resident memory samples per trace with -R */
+#define RSS_TICK_MS    5 /* ms idle, then a purge, before each sample */
+#define RSS_LAST_TICKS 5 /* idle ticks before the last sample */
+#define RSS_POLICIES   3 /* memory return policies compared by -R */
+
+/* Rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -60,6 +82,9 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int null_ids;        /* ids reallocated or freed before any alloc */
+    int leaked;          /* ids still allocated after the last request... */
+    int *leaks;          /* ... and the ids themselves */
 } trace_t;
 
 /* 
@@ -81,10 +106,40 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    long long counts[FPERF_NEVENTS]; /* hardware events of one run (-c) */
+    int leaked;      /* blocks the trace never frees (-E) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* The params to lookup_speed, which is timed by fbench (-L) */
+typedef struct {
+    mm_heap_t *heap;  /* heap whose class table is used */
+    int *sizes;       /* request sizes of a trace */
+    int n;            /* number of entries in sizes */
+    int scan;         /* use scan_class instead of mm_size_class_r */
+    int sum;          /* sum of the classes, so the lookups are not dropped */
+} lookup_t;
+
+/* The params to pool_speed and pool_mm_speed, timed by fbench (-O) */
+typedef struct {
+    mm_pool_t *pool;  /* pool allocator under test... */
+    mm_heap_t *heap;  /* ... or mm heap under test */
+    size_t size;      /* object size */
+    void **objs;      /* the objects of one run */
+    int *order;       /* a random permutation of 0..POOL_OBJS-1 */
+} pool_bench_t;
+
+/* Summarizes one run of a trace on the handle-based allocator (-H) */
+typedef struct {
+    int valid;          /* did every block keep its contents? */
+    int cycles;         /* number of completed compaction cycles */
+    double util;        /* peak payload bytes / peak heap size */
+    double util_before; /* mean utilization when a cycle started... */
+    double util_after;  /* ... and when it completed */
+    size_t moved;       /* bytes moved by the compactor */
+} hstats_t;
+
 /********************
  * Global variables
  *******************/
@@ -100,6 +155,20 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The real program traces of the extended suite (-E) */
+static char *extended_tracefiles[] = {
+    EXTENDED_TRACEFILES, NULL
+};
+
+/* The traces and memory return policies (trim, decay) compared by -R */
+static char *rss_tracefiles[] = {
+    RSS_TRACEFILES, NULL
+};
+static const char *rss_names[RSS_POLICIES] = {"none", "default", "eager"};
+static const long rss_policies[RSS_POLICIES][2] = {
+    {0, -1}, {MM_TRIM_DEFAULT, MM_DECAY_DEFAULT}, {MM_TRIM_DEFAULT, 0}
+};
+
 
 /********************* 
  * Function prototypes 
@@ -114,6 +183,8 @@ static void clear_ranges(range_t **ranges);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static void find_leaks(trace_t *trace);
+static void clear_blocks(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -125,8 +196,47 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Measures collection pauses of the mm garbage collector (-G) */
+static void eval_mm_gc(trace_t *trace, int tracenum);
+
+/* Counts dTLB misses with 4 KB and huge-page heaps (-T) */
+static void eval_mm_tlb(trace_t *trace, long long misses[2], int hugepages);
+
+/* Counts cycles per op with cold, warm and steady caches (-m) */
+static void eval_mm_cache(trace_t *trace, double cycles[3]);
+
+/* Collects the mm_stats of a trace at its peak and at its end (-s) */
+static void eval_mm_stats(trace_t *trace, mm_stats_t *peak, mm_stats_t *end);
+
+/* Checks and times the size class lookup of mm.c (-L) */
+static int scan_class(mm_heap_t *heap, int size);
+static int check_lookup(mm_heap_t *heap);
+static void lookup_speed(void *ptr);
+static void eval_mm_lookup(trace_t *trace, mm_heap_t *heaps[2], double ns[4]);
+
+/* Follows the resident memory of the heap through a trace (-R) */
+static void eval_mm_rss(trace_t *trace, int policy, size_t rss[RSS_SAMPLES],
+			size_t live[RSS_SAMPLES]);
+
+/* Compares the pool allocator in mmpool.c with mm_malloc (-O) */
+static void pool_speed(void *ptr);
+static void pool_mm_speed(void *ptr);
+static void eval_mm_pool(size_t size, double mops[2], size_t bytes[2]);
+
+/* Evaluates the handle-based allocator in mmh.c (-H) */
+static void eval_mm_handles(trace_t *trace, int tracenum, hstats_t *hstats);
+
+/* Saves and loads the benchmark samples of each trace (-B, -X) */
+static void write_bench(char *path, char **tracefiles, int n, 
+			stats_t *stats, fbench_t *bench);
+static int read_bench(char *path, char **tracefiles, int n, fbench_t *bench);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static double printextended(int n, stats_t *stats, char **tracefiles);
+static void printcounters(int n, stats_t *stats);
+static int printbench(int n, stats_t *stats, fbench_t *bench, 
+		      fbench_t *base, char *basefile);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +260,37 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int run_gc = 0;      /* If set, benchmark the garbage collector (-G) */
+    int run_handles = 0; /* If set, evaluate the handle allocator (-H) */
+    hstats_t hstats;     /* handle allocator stats for one trace */
+    int hugepages = 0;   /* If set, back the heap with huge pages (-P) */
+    int run_tlb = 0;     /* If set, compare dTLB misses of 4K/2M pages (-T) */
+    int run_counters = 0;/* If set, count hardware events per trace (-c) */
+    int run_cache = 0;   /* If set, time cold, warm and steady caches (-m) */
+    int run_classes = 0; /* If set, compare size class tables (-z) */
+    int run_lookup = 0;  /* If set, check and time the class lookup (-L) */
+    int run_stats = 0;   /* If set, print the allocator statistics (-s) */
+    int run_pool = 0;    /* If set, compare the pool allocator (-O) */
+    int run_rss = 0;     /* If set, follow the resident heap memory (-R) */
+    int extended = 0;    /* If set, score the real program traces (-E) */
+    size_t rss[RSS_POLICIES][RSS_SAMPLES]; /* resident bytes by policy */
+    size_t live[RSS_SAMPLES];              /* payload bytes at each sample */
+    double pool_mops[2]; /* M allocations per second, pool and mm */
+    size_t pool_bytes[2];/* peak heap size, pool and mm */
+    mm_stats_t peak, end;/* mm_stats at the peak and the end of a trace */
+    mm_heap_t *lookup_heaps[2]; /* heaps with pow2 and profiled classes */
+    double lookup_ns[4]; /* ns per lookup, scan and table, for each heap */
+    double prof_util;    /* utilization with the profiled classes */
+    double cycles[3];    /* cycles per run in each cache state */
+    int llc, line;       /* last level cache size and line size */
+    long long misses[2]; /* dTLB misses with 4K and huge pages */
+    long prof_rate = 0;  /* If set, sample the heap every prof_rate bytes (-p) */
+    int bench_iters = 0; /* If set, benchmark with this many timed runs (-B) */
+    int bench_cpu = -1;  /* If set, pin the driver to this CPU (-C) */
+    char *basefile = NULL;   /* benchmark of an earlier build to compare (-X) */
+    fbench_t *bench = NULL;  /* benchmark of each trace */
+    fbench_t *base = NULL;   /* benchmark of each trace read from basefile */
+    int regressions = 0;     /* traces significantly slower than in basefile */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +299,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcmszEGHLOPRTp:B:C:X:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +325,56 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'B': /* Benchmark the mm runs with <n> timed runs each */
+            bench_iters = atoi(optarg);
+            break;
+        case 'C': /* Pin the driver to one CPU */
+            bench_cpu = atoi(optarg);
+            break;
+        case 'X': /* Compare the benchmark with an earlier one */
+            basefile = optarg;
+            if (bench_iters == 0)
+                bench_iters = BENCH_ITERS;
+            break;
+        case 'c': /* Count hardware events of the mm runs */
+            run_counters = 1;
+            break;
+        case 'm': /* Time each trace in different cache states */
+            run_cache = 1;
+            break;
+        case 's': /* Print the allocator statistics of each trace */
+            run_stats = 1;
+            break;
+        case 'z': /* Compare profiled and power-of-two size classes */
+            run_classes = 1;
+            break;
+        case 'L': /* Check and time the size class lookup */
+            run_lookup = 1;
+            break;
+        case 'O': /* Compare the pool allocator with mm_malloc */
+            run_pool = 1;
+            break;
+        case 'E': /* Score the extended suite of real program traces */
+            extended = 1;
+            break;
+        case 'R': /* Follow the resident heap memory over time */
+            run_rss = 1;
+            break;
+        case 'G': /* Measure garbage collection pauses */
+            run_gc = 1;
+            break;
+        case 'H': /* Evaluate the handle-based allocator */
+            run_handles = 1;
+            break;
+        case 'P': /* Back the heap with huge pages */
+            hugepages = 1;
+            break;
+        case 'T': /* Count dTLB misses with 4K and huge pages */
+            run_tlb = 1;
+            break;
+        case 'p': /* Profile the mm heap, sampling every <n> bytes */
+            prof_rate = atol(optarg);
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -229,12 +420,21 @@ int main(int argc, char **argv)
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
      */
+    if (tracefiles == NULL && extended) {
+        tracefiles = extended_tracefiles;
+        num_tracefiles = sizeof(extended_tracefiles) / sizeof(char *) - 1;
+	printf("Using extended tracefiles in %s\n", tracedir);
+    }
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Keep every measurement on the same core */
+    if (bench_cpu >= 0 && set_fbench_cpu(bench_cpu) < 0)
+	unix_error("Could not pin the driver to the requested CPU");
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -285,12 +485,20 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
+    set_mem_hugepages(hugepages);
     mem_init(); 
 
+    /* Start the heap profiler; SIGUSR2 dumps the in-use profile */
+    if (prof_rate > 0) {
+	mmprof_start(prof_rate);
+	mmprof_dump_on_signal(SIGUSR2, PROFFILE);
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
+	mm_stats[i].leaked = trace->leaked;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
@@ -303,10 +511,23 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (run_counters)
+		fperf(eval_mm_speed, &speed_params, mm_stats[i].counts);
 	}
 	free_trace(trace);
     }
 
+    /* Write the allocation profile of the mm runs */
+    if (prof_rate > 0) {
+	FILE *fp;
+	mmprof_stop();
+	if ((fp = fopen(PROFFILE, "w")) == NULL)
+	    unix_error("Could not open " PROFFILE);
+	printf("Wrote %d heap profile stacks to %s\n", 
+	       mmprof_dump(fp, MMPROF_ALLOC), PROFFILE);
+	fclose(fp);
+    }
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
@@ -314,6 +535,266 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the hardware events of each mm run */
+    if (run_counters) {
+	printf("Hardware events per op for mm malloc:\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally benchmark each trace with repeated runs, save the
+     * samples and compare them with those of an earlier build
+     */
+    if (bench_iters > 0) {
+	set_fbench_iters(bench_iters);
+	bench = (fbench_t *)calloc(num_tracefiles, sizeof(fbench_t));
+	base = (fbench_t *)calloc(num_tracefiles, sizeof(fbench_t));
+	if (bench == NULL || base == NULL)
+	    unix_error("bench calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    speed_params.trace = trace;
+	    if (fbench(eval_mm_speed, &speed_params, &bench[i]) < 0)
+		unix_error("fbench failed in main");
+	    free_trace(trace);
+	}
+	write_bench(BENCHFILE, tracefiles, num_tracefiles, mm_stats, bench);
+	if (basefile != NULL &&
+	    read_bench(basefile, tracefiles, num_tracefiles, base) < 0)
+	    unix_error("Could not read the benchmark to compare with");
+	regressions = printbench(num_tracefiles, mm_stats, bench, base, basefile);
+	printf("\n");
+    }
+
+    /*
+     * Optionally print what mm_stats reports about each trace: its
+     * counters after the whole trace, and the heap at its peak
+     */
+    if (run_stats) {
+	printf("Allocator statistics (heap at the peak of the payload):\n");
+	printf("%5s%8s%7s%8s%9s%8s%8s%9s%9s%8s\n", "trace", "ops", "sbrk", 
+	       "splits", "coalesce", "re-inpl", "re-copy", "alloc KB", 
+	       "free KB", "nfree");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid) {
+		printf("%2d%11.0f%7s%8s%9s%8s%8s%9s%9s%8s\n", i, 
+		       mm_stats[i].ops, "-", "-", "-", "-", "-", "-", "-", "-");
+		continue;
+	    }
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_stats(trace, &peak, &end);
+	    printf("%2d%11d%7lu%8lu%9lu%8lu%8lu%9.1f%9.1f%8lu\n", i, 
+		   trace->num_ops, (unsigned long)end.sbrks, 
+		   (unsigned long)end.splits, (unsigned long)end.coalesces,
+		   (unsigned long)end.realloc_inplace, 
+		   (unsigned long)end.realloc_copy, peak.alloc_bytes/1024.0,
+		   peak.free_bytes/1024.0, (unsigned long)peak.free_blocks);
+	    if (verbose > 1) {
+		int k;
+		printf("%13s", "free lists:");
+		for (k = 0; k < MM_MAXCLASSES + MM_NLARGE; k++)
+		    if (peak.list_blocks[k] > 0)
+			printf(" %d:%d", k, peak.list_blocks[k]);
+		printf("\n");
+	    }
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally compare the utilization of the default power-of-two
+     * size classes with the profiled ones in sizeclasses.h
+     */
+    if (run_classes) {
+	printf("Utilization by size classes:\n");
+	printf("%5s%9s%10s%8s\n", "trace", "pow2", "profiled", "gain");
+	secs = util = 0;  /* used as sums of the utilizations */
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid) {
+		printf("%2d%12s%10s%8s\n", i, "-", "-", "-");
+		continue;
+	    }
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mm_set_classes(MM_CLASSES_PROFILED);
+	    prof_util = eval_mm_util(trace, i, &ranges);
+	    mm_set_classes(MM_CLASSES_POW2);
+	    printf("%2d%11.0f%%%9.0f%%%+7.1f%%\n", i, mm_stats[i].util*100.0, 
+		   prof_util*100.0, (prof_util - mm_stats[i].util)*100.0);
+	    secs += mm_stats[i].util;
+	    util += prof_util;
+	    free_trace(trace);
+	}
+	printf("%5s%7.0f%%%9.0f%%%+7.1f%%\n\n", "Avg  ", 
+	       secs*100.0/num_tracefiles, util*100.0/num_tracefiles, 
+	       (util - secs)*100.0/num_tracefiles);
+    }
+
+    /*
+     * Optionally check the size class lookup against a plain scan of
+     * the class limits, and time both on the request sizes of each trace
+     */
+    if (run_lookup) {
+	for (i=0; i < 2; i++) {
+	    if ((lookup_heaps[i] = mm_heap_create(MAX_HEAP)) == NULL)
+		unix_error("mm_heap_create failed in main");
+	    mm_set_classes_r(lookup_heaps[i], i == 0 ? MM_CLASSES_POW2 
+			     : MM_CLASSES_PROFILED);
+	    if (mm_init_r(lookup_heaps[i]) < 0)
+		app_error("mm_init_r failed in main");
+	    if (check_lookup(lookup_heaps[i]) < 0)
+		errors++;
+	}
+	printf("Size class lookup, ns per request:\n");
+	printf("%5s%8s%10s%10s%10s%10s\n", "trace", "ops", 
+	       "pow2 scan", "clz", "prof scan", "table");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_lookup(trace, lookup_heaps, lookup_ns);
+	    printf("%2d%11d%10.2f%10.2f%10.2f%10.2f\n", i, trace->num_ops,
+		   lookup_ns[0], lookup_ns[1], lookup_ns[2], lookup_ns[3]);
+	    free_trace(trace);
+	}
+	for (i=0; i < 2; i++)
+	    mm_heap_destroy(lookup_heaps[i]);
+	printf("\n");
+    }
+
+    /*
+     * Optionally compare the fixed-size pool allocator with mm_malloc
+     * on small objects
+     */
+    if (run_pool) {
+	printf("Pool allocator vs mm_malloc, %d objects:\n", POOL_OBJS);
+	printf("%5s%10s%10s%9s%10s%10s\n", "size", "pool M/s", "mm M/s", 
+	       "speedup", "pool KB", "mm KB");
+	for (i = 16; i <= 64; i *= 2) {
+	    eval_mm_pool(i, pool_mops, pool_bytes);
+	    printf("%5d%10.1f%10.1f%8.1fx%10lu%10lu\n", i, pool_mops[0], 
+		   pool_mops[1], pool_mops[0]/pool_mops[1], 
+		   (unsigned long)pool_bytes[0] >> 10, 
+		   (unsigned long)pool_bytes[1] >> 10);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay the traces whose heap peaks and drops with
+     * each memory return policy, and follow the resident memory
+     */
+    if (run_rss) {
+	int j, k;
+	for (i=0; rss_tracefiles[i] != NULL; i++) {
+	    trace = read_trace(tracedir, rss_tracefiles[i]);
+	    for (j = 0; j < RSS_POLICIES; j++)
+		eval_mm_rss(trace, j, rss[j], live);
+	    printf("Resident heap KB of %s, %d ms idle every %d ops "
+		   "(%d ms at the end):\n", rss_tracefiles[i], RSS_TICK_MS,
+		   trace->num_ops / RSS_SAMPLES, RSS_LAST_TICKS * RSS_TICK_MS);
+	    printf("%8s%8s", "op", "live");
+	    for (j = 0; j < RSS_POLICIES; j++)
+		printf("%9s", rss_names[j]);
+	    printf("\n");
+	    for (k = 0; k < RSS_SAMPLES; k++) {
+		printf("%8d%8lu", (k + 1) * trace->num_ops / RSS_SAMPLES,
+		       (unsigned long)live[k] >> 10);
+		for (j = 0; j < RSS_POLICIES; j++)
+		    printf("%9lu", (unsigned long)rss[j][k] >> 10);
+		printf("\n");
+	    }
+	    printf("\n");
+	    free_trace(trace);
+	}
+    }
+
+    /*
+     * Optionally time each trace starting from cold caches, from
+     * caches warmed by one run, and in steady state
+     */
+    if (run_cache) {
+	llc = get_fcyc_cache_size(0, &line);
+	printf("Cycles per op by cache state (LLC %d KB, %d B lines):\n",
+	       llc >> 10, line);
+	printf("%5s%8s%10s%10s%10s\n", "trace", "ops", "cold", "warm", "steady");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid) {
+		printf("%2d%11.0f%10s%10s%10s\n", i, mm_stats[i].ops, 
+		       "-", "-", "-");
+		continue;
+	    }
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_cache(trace, cycles);
+	    printf("%2d%11d%10.1f%10.1f%10.1f\n", i, trace->num_ops, 
+		   cycles[FCYC_COLD]/trace->num_ops, 
+		   cycles[FCYC_WARM]/trace->num_ops,
+		   cycles[FCYC_STEADY]/trace->num_ops);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally count the dTLB misses of each trace with the heap
+     * backed by 4 KB pages and by huge pages
+     */
+    if (run_tlb) {
+	printf("dTLB load misses, 4K vs huge pages:\n");
+	printf("%5s%8s%12s%12s%8s%8s\n", 
+	       "trace", "ops", "4K", "2M", "4K/op", "2M/op");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_tlb(trace, misses, hugepages);
+	    if (misses[0] < 0 || misses[1] < 0)
+		printf("%2d%11d%12s%12s%8s%8s\n", i, trace->num_ops, 
+		       "-", "-", "-", "-");
+	    else
+		printf("%2d%11d%12lld%12lld%8.3f%8.3f\n", i, trace->num_ops,
+		       misses[0], misses[1], (double)misses[0]/trace->num_ops,
+		       (double)misses[1]/trace->num_ops);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace without frees and let the
+     * garbage collector reclaim the dropped blocks
+     */
+    if (run_gc) {
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_gc(trace, i);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace through the handle-based allocator
+     * and report utilization around its compaction cycles
+     */
+    if (run_handles) {
+	printf("Results for the handle allocator:\n");
+	printf("%5s%7s%6s%8s%7s%10s%10s\n", 
+	       "trace", " valid", "util", "cycles", "before", "after", "moved KB");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_handles(trace, i, &hstats);
+	    if (hstats.valid)
+		printf("%2d%10s%5.0f%%%8d%6.0f%%%9.0f%%%10lu\n", i, "yes",
+		       hstats.util*100.0, hstats.cycles,
+		       hstats.util_before*100.0, hstats.util_after*100.0,
+		       (unsigned long)hstats.moved >> 10);
+	    else
+		printf("%2d%10s%6s%8s%7s%10s%10s\n", i, "no", "-", "-", "-", "-", "-");
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -330,6 +811,10 @@ int main(int argc, char **argv)
     }
     avg_mm_util = util/num_tracefiles;
 
+    /* The extended suite weights the utilization of each trace by its ops */
+    if (extended && errors == 0)
+	avg_mm_util = printextended(num_tracefiles, mm_stats, tracefiles);
+
     /* 
      * Compute and print the performance index 
      */
@@ -346,7 +831,8 @@ int main(int argc, char **argv)
 	}
 	
 	perfindex = (p1 + p2)*100.0;
-	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+	printf("%s index = %.0f (util) + %.0f (thru) = %.0f/100\n",
+	       extended ? "Extended" : "Perf",
 	       p1*100, 
 	       p2*100, 
 	       perfindex);
@@ -362,6 +848,12 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Fail if the comparison found a slower trace */
+    if (regressions > 0) {
+	printf("%d significant regressions against %s\n", regressions, basefile);
+	exit(2);
+    }
+
     exit(0);
 }
 
@@ -480,6 +972,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    int free_index;
+    int complete;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -505,64 +999,134 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
+    /* 
+     * We'll keep an array of pointers to the allocated blocks here...
+     * The extra last entry stands for id -1, which is never allocated,
+     * so freeing it frees NULL.
+     */
     if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	 (char **)calloc(trace->num_ids + 1, sizeof(char *))) == NULL)
 	unix_error("malloc 3 failed in read_trace");
 
     /* ... along with the corresponding byte sizes of each block */
     if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	 (size_t *)calloc(trace->num_ids + 1, sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
     
-    /* read every request line in the trace file */
+    /* 
+     * read every request line in the trace file; lines past num_ops and
+     * a truncated last line are ignored
+     */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    while (op_index < trace->num_ops && fscanf(tracefile, "%s", type) != EOF) {
 	switch(type[0]) {
 	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    complete = (fscanf(tracefile, "%u %u", &index, &size) == 2);
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	    complete = (fscanf(tracefile, "%u %u", &index, &size) == 2);
 	    trace->ops[op_index].type = REALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
-	    fscanf(tracefile, "%ud", &index);
+	    complete = (fscanf(tracefile, "%d", &free_index) == 1);
+	    if (free_index == -1)
+		free_index = trace->num_ids;
+	    else
+		max_index = ((unsigned)free_index > max_index) ? 
+		    (unsigned)free_index : max_index;
 	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].index = free_index;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
 	    exit(1);
 	}
+	if (!complete)
+	    break;
 	op_index++;
 	
     }
     fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    if (op_index < trace->num_ops) {
+	if (verbose > 1)
+	    printf("Only %d of %d requests in tracefile %s\n", 
+		   op_index, trace->num_ops, path);
+	trace->num_ops = op_index;
+    }
+    if (max_index >= trace->num_ids) {
+	sprintf(msg, "Request id %u out of range in tracefile %s", 
+		max_index, path);
+	app_error(msg);
+    }
+    find_leaks(trace);
     
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * find_leaks - Count the ids of a trace that are reallocated or freed
+ *     before they are allocated, and list the ids that are never freed.
+ *     Balanced traces have neither; captured real program traces have
+ *     both.
+ */
+static void find_leaks(trace_t *trace)
+{
+    int i, index;
+    char *state;  /* 0 = not used yet, 1 = allocated, 2 = freed */
+
+    if ((state = calloc(trace->num_ids + 1, 1)) == NULL)
+	unix_error("calloc failed in find_leaks");
+    trace->null_ids = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (index == trace->num_ids)
+	    continue;
+	if (state[index] == 0 && trace->ops[i].type != ALLOC)
+	    trace->null_ids++;
+	state[index] = (trace->ops[i].type == FREE) ? 2 : 1;
+    }
+
+    trace->leaked = 0;
+    if ((trace->leaks = malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in find_leaks");
+    for (index = 0; index < trace->num_ids; index++)
+	if (state[index] == 1)
+	    trace->leaks[trace->leaked++] = index;
+    free(state);
+}
+
+/*
+ * clear_blocks - Forget the blocks of an earlier run of a trace that
+ *     reallocates or frees ids before allocating them, so those
+ *     requests see NULL again. 
+ */
+static void clear_blocks(trace_t *trace)
+{
+    if (trace->null_ids == 0)
+	return;
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+}
+
+/*
+ * free_trace - Free the trace record and the four arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the four arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->leaks);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -587,6 +1151,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
+    clear_blocks(trace);
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
@@ -653,7 +1218,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if (newp[j] != (char)(index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -690,9 +1255,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
  *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   package on the trace. Our implementation of mem_sbrk() lets the
+ *   brk pointer be decremented, so heapsize is taken to be the high
+ *   water mark of brk rather than its final value.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -707,6 +1272,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    clear_blocks(trace);
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
@@ -774,7 +1340,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -790,6 +1356,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
+    clear_blocks(trace);
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
@@ -825,6 +1392,505 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_gc - Replay a trace against the garbage-collected heap. A free
+ *    request only drops the driver's pointer to the block; the block
+ *    array is the explicit root set, and the mutator stack is scanned
+ *    conservatively. Every num_ops/GC_SAMPLES requests we run a
+ *    collection and report its pause time against the heap size.
+ */
+static void eval_mm_gc(trace_t *trace, int tracenum)
+{
+    int i, index;
+    char *p;
+    size_t freed, total_freed = 0;
+    struct timespec start, end;
+    double pause, total_pause = 0;
+    int interval = trace->num_ops / GC_SAMPLES;
+
+    if (interval == 0)
+	interval = 1;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_gc");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    mm_gc_enable(MM_GC_STACK);
+    if (mm_gc_add_root(trace->blocks, trace->num_ids * sizeof(char *)) < 0)
+	unix_error("mm_gc_add_root failed in eval_mm_gc");
+
+    printf("GC pauses for trace %d:\n", tracenum);
+    printf("%8s%10s%10s%10s\n", "op", "heap(KB)", "freed(KB)", "pause(us)");
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_gc");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_gc");
+	    trace->blocks[index] = p;
+	    break;
+
+        case FREE: /* drop the reference instead of calling mm_free */
+	    trace->blocks[index] = NULL;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_gc");
+        }
+
+	if ((i+1) % interval == 0 || i == trace->num_ops - 1) {
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    freed = mm_gc_collect();
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    pause = 1e6*(end.tv_sec - start.tv_sec) + 
+		1e-3*(end.tv_nsec - start.tv_nsec);
+	    printf("%8d%10.1f%10.1f%10.1f\n", i+1, mem_heapsize()/1024.0, 
+		   freed/1024.0, pause);
+	    total_freed += freed;
+	    total_pause += pause;
+	}
+    }
+    printf("%8s%10.1f%10.1f%10.1f\n", "Total", mem_heapsize()/1024.0,
+	   total_freed/1024.0, total_pause);
+
+    mm_gc_remove_root(trace->blocks);
+    mm_gc_enable(0);
+}
+
+/*
+ * eval_mm_tlb - Count the dTLB load misses of eval_mm_speed on a trace,
+ *    first with the default heap backed by 4 KB pages, then by huge 
+ *    pages. Each count is taken on a second run, after the heap pages
+ *    have been faulted in. A count is -1 if it isn't available. The
+ *    default heap is then recreated the way the -P flag asked for.
+ */
+static void eval_mm_tlb(trace_t *trace, long long misses[2], int hugepages)
+{
+    int hp;
+    speed_t speed_params;
+    long long counts[FPERF_NEVENTS];
+
+    speed_params.trace = trace;
+    for (hp = 0; hp < 2; hp++) {
+	mem_deinit();
+	set_mem_hugepages(hp);
+	mem_init();
+	eval_mm_speed(&speed_params);
+	fperf(eval_mm_speed, &speed_params, counts);
+	misses[hp] = counts[FPERF_DTLB_MISSES];
+    }
+    mem_deinit();
+    set_mem_hugepages(hugepages);
+    mem_init();
+}
+
+/*
+ * eval_mm_cache - Count the cycles of eval_mm_speed on a trace in each
+ *    fcyc cache state. The flushes use clflush on the heap and the
+ *    trace arrays, the only memory the run touches, which is much
+ *    cheaper than sweeping an eviction buffer the size of the LLC.
+ */
+static void eval_mm_cache(trace_t *trace, double cycles[3])
+{
+    int mode, old_mode;
+    speed_t speed_params;
+
+    speed_params.trace = trace;
+    eval_mm_speed(&speed_params);  /* to learn the peak heap size */
+
+    reset_fcyc_flush_regions();
+    add_fcyc_flush_region(mem_heap_lo(), mem_peaksize());
+    add_fcyc_flush_region(trace->ops, trace->num_ops * sizeof(traceop_t));
+    add_fcyc_flush_region(trace->blocks, trace->num_ids * sizeof(char *));
+    add_fcyc_flush_region(trace->block_sizes, trace->num_ids * sizeof(size_t));
+    add_fcyc_flush_region(trace, sizeof(trace_t));
+    old_mode = set_fcyc_mode(FCYC_COLD);
+    for (mode = FCYC_COLD; mode <= FCYC_STEADY; mode++) {
+	set_fcyc_mode(mode);
+	cycles[mode] = fcyc(eval_mm_speed, &speed_params);
+    }
+    set_fcyc_mode(old_mode);
+    reset_fcyc_flush_regions();
+}
+
+/*
+ * eval_mm_stats - Replay a trace on a fresh default heap and take its
+ *    mm_stats when the total payload reaches its peak and after the
+ *    last request.
+ */
+static void eval_mm_stats(trace_t *trace, mm_stats_t *peak, mm_stats_t *end)
+{
+    int i, index, size;
+    int total_size = 0, max_total_size = -1;
+    char *p;
+
+    mem_reset_brk();
+    clear_blocks(trace);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stats");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_stats");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_stats");
+	    total_size += size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_stats");
+	}
+	if (total_size > max_total_size) {
+	    max_total_size = total_size;
+	    mm_stats(peak);
+	}
+    }
+    mm_stats(end);
+}
+
+/*
+ * eval_mm_rss - Replay a trace on a fresh heap with memory return
+ *    policy number policy, idling after each of RSS_SAMPLES evenly
+ *    spaced requests: RSS_TICK_MS, then an mm_purge_r as an idle
+ *    program would call it, RSS_LAST_TICKS times after the last. Stores
+ *    the resident bytes of the heap and the payload bytes after each
+ *    idle period in rss and live.
+ */
+static void eval_mm_rss(trace_t *trace, int policy, size_t rss[RSS_SAMPLES],
+			size_t live[RSS_SAMPLES])
+{
+    mm_heap_t *h;
+    int i, k, t, index, size;
+    size_t total_size = 0;
+    struct timespec tick = {0, RSS_TICK_MS * 1000000L};
+    char *p;
+
+    if ((h = mm_heap_create(MAX_HEAP)) == NULL)
+	unix_error("mm_heap_create failed in eval_mm_rss");
+    /* The region may be recycled from an earlier heap: start it cold */
+    mem_release_r(h->mem, h->mem->start_brk, h->mem->max_addr - h->mem->start_brk);
+    mm_set_return_r(h, rss_policies[policy][0], rss_policies[policy][1]);
+    if (mm_init_r(h) < 0)
+	app_error("mm_init_r failed in eval_mm_rss");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+
+    for (i = 0, k = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc_r(h, size)) == NULL)
+		app_error("mm_malloc_r failed in eval_mm_rss");
+	    total_size += size;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case REALLOC:
+	    p = mm_realloc_r(h, trace->blocks[index], size);
+	    if (p == NULL && size > 0)
+		app_error("mm_realloc_r failed in eval_mm_rss");
+	    total_size += size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    mm_free_r(h, trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    trace->blocks[index] = NULL;
+	    trace->block_sizes[index] = 0;
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_rss");
+	}
+	if (i + 1 == (k + 1) * trace->num_ops / RSS_SAMPLES) {
+	    for (t = 0; t < (k + 1 == RSS_SAMPLES ? RSS_LAST_TICKS : 1); t++) {
+		nanosleep(&tick, NULL);
+		mm_purge_r(h);
+	    }
+	    rss[k] = mem_resident_r(h->mem);
+	    live[k++] = total_size;
+	}
+    }
+    mm_heap_destroy(h);
+}
+
+/*
+ * pool_speed - Allocate POOL_OBJS objects from the pool and free them
+ *    in random order.
+ */
+static void pool_speed(void *ptr)
+{
+    pool_bench_t *pb = (pool_bench_t *)ptr;
+    int i;
+
+    for (i = 0; i < POOL_OBJS; i++)
+	pb->objs[i] = mm_pool_alloc(pb->pool);
+    for (i = 0; i < POOL_OBJS; i++)
+	mm_pool_free(pb->pool, pb->objs[pb->order[i]]);
+}
+
+/*
+ * pool_mm_speed - The same as pool_speed with mm_malloc_r and mm_free_r.
+ */
+static void pool_mm_speed(void *ptr)
+{
+    pool_bench_t *pb = (pool_bench_t *)ptr;
+    int i;
+
+    for (i = 0; i < POOL_OBJS; i++)
+	pb->objs[i] = mm_malloc_r(pb->heap, pb->size);
+    for (i = 0; i < POOL_OBJS; i++)
+	mm_free_r(pb->heap, pb->objs[pb->order[i]]);
+}
+
+/*
+ * eval_mm_pool - Time POOL_OBJS allocations and frees of size-byte
+ *    objects with a pool and with an mm heap. Stores the millions of
+ *    allocations (each with its free) per second in mops and the peak
+ *    heap sizes in bytes, pool first.
+ */
+static void eval_mm_pool(size_t size, double mops[2], size_t bytes[2])
+{
+    pool_bench_t pb;
+    fbench_t res;
+    int i, j, tmp;
+
+    pb.objs = malloc(POOL_OBJS * sizeof(void *));
+    pb.order = malloc(POOL_OBJS * sizeof(int));
+    if (pb.objs == NULL || pb.order == NULL)
+	unix_error("malloc failed in eval_mm_pool");
+    srand(1);
+    for (i = 0; i < POOL_OBJS; i++)
+	pb.order[i] = i;
+    for (i = POOL_OBJS - 1; i > 0; i--) {
+	j = rand() % (i + 1);
+	tmp = pb.order[i];
+	pb.order[i] = pb.order[j];
+	pb.order[j] = tmp;
+    }
+    pb.size = size;
+
+    if ((pb.pool = mm_pool_create(size, MAX_HEAP)) == NULL)
+	app_error("mm_pool_create failed in eval_mm_pool");
+    if (fbench(pool_speed, &pb, &res) < 0)
+	unix_error("fbench failed in eval_mm_pool");
+    mops[0] = POOL_OBJS / res.median / 1e6;
+    bytes[0] = (size_t)pb.pool->npages * MM_POOL_PAGE;
+    fbench_free(&res);
+    mm_pool_destroy(pb.pool);
+
+    if ((pb.heap = mm_heap_create(MAX_HEAP)) == NULL)
+	unix_error("mm_heap_create failed in eval_mm_pool");
+    if (mm_init_r(pb.heap) < 0)
+	app_error("mm_init_r failed in eval_mm_pool");
+    if (fbench(pool_mm_speed, &pb, &res) < 0)
+	unix_error("fbench failed in eval_mm_pool");
+    mops[1] = POOL_OBJS / res.median / 1e6;
+    bytes[1] = mem_peaksize_r(pb.heap->mem);
+    fbench_free(&res);
+    mm_heap_destroy(pb.heap);
+
+    free(pb.objs);
+    free(pb.order);
+}
+
+/*
+ * scan_class - The reference size class lookup for -L: scan the class
+ *    limits of heap for the first one that holds the aligned size,
+ *    and count the bits of sizes above the largest class.
+ */
+static int scan_class(mm_heap_t *heap, int size)
+{
+    int c, asize = ALIGN(size);
+
+    for (c = 0; c < heap->nclasses; c++)
+	if (heap->limits[c] >= asize)
+	    return c;
+    for (c = 0; (asize >> c) > 1; c++)
+	;
+    return MM_MAXCLASSES + c;
+}
+
+/*
+ * check_lookup - Compare mm_size_class_r with scan_class for every
+ *    request size up to LOOKUP_MAX. Returns 0, or -1 after reporting
+ *    the first size they disagree on.
+ */
+static int check_lookup(mm_heap_t *heap)
+{
+    int size;
+
+    for (size = 1; size <= LOOKUP_MAX; size++) {
+	if (mm_size_class_r(heap, size) != scan_class(heap, size)) {
+	    printf("ERROR: mm_size_class_r puts a %d byte request on list %d, "
+		   "expected %d\n", size, mm_size_class_r(heap, size), 
+		   scan_class(heap, size));
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * lookup_speed - Look up the class of every request size LOOKUP_REPS
+ *    times.
+ */
+static void lookup_speed(void *ptr)
+{
+    lookup_t *l = (lookup_t *)ptr;
+    int i, rep, sum = 0;
+
+    for (rep = 0; rep < LOOKUP_REPS; rep++) {
+	if (l->scan)
+	    for (i = 0; i < l->n; i++)
+		sum += scan_class(l->heap, l->sizes[i]);
+	else
+	    for (i = 0; i < l->n; i++)
+		sum += mm_size_class_r(l->heap, l->sizes[i]);
+    }
+    l->sum = sum;
+}
+
+/*
+ * eval_mm_lookup - Time the class lookup of the malloc and realloc
+ *    requests of a trace, for the power-of-two and the profiled heap,
+ *    each with scan_class and with mm_size_class_r. Stores the median
+ *    ns per request in that order in ns.
+ */
+static void eval_mm_lookup(trace_t *trace, mm_heap_t *heaps[2], double ns[4])
+{
+    int i, k;
+    lookup_t l;
+    fbench_t res;
+
+    if ((l.sizes = malloc(trace->num_ops * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_lookup");
+    for (i = 0, l.n = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type != FREE)
+	    l.sizes[l.n++] = trace->ops[i].size;
+
+    for (k = 0; k < 4; k++) {
+	l.heap = heaps[k / 2];
+	l.scan = (k % 2 == 0);
+	ns[k] = 0;
+	if (l.n > 0 && fbench(lookup_speed, &l, &res) == 0) {
+	    ns[k] = res.median * 1e9 / ((double)l.n * LOOKUP_REPS);
+	    fbench_free(&res);
+	}
+    }
+    free(l.sizes);
+}
+
+/*
+ * eval_mm_handles - Replay a trace through the handle-based allocator
+ *    with incremental compaction, and measure the space utilization
+ *    (payload bytes / heap size) at the moments each compaction cycle
+ *    starts and completes. Each payload is filled with the low byte of
+ *    its id and checked when the block is freed, to make sure the
+ *    compactor moved its contents correctly.
+ */
+static void eval_mm_handles(trace_t *trace, int tracenum, hstats_t *hstats)
+{
+    int i, index, size;
+    int running = 0, started = 0, cycles = 0;
+    int total_size = 0, max_total_size = 0;
+    double util, util_before = 0, util_after = 0;
+    char *p;
+    mm_handle_t *handles;
+    mm_hheap_t *hh;
+
+    if ((handles = malloc(trace->num_ids * sizeof(mm_handle_t))) == NULL)
+	unix_error("malloc failed in eval_mm_handles");
+    if ((hh = mm_hheap_create(MAX_HEAP, HBUDGET)) == NULL)
+	unix_error("mm_hheap_create failed in eval_mm_handles");
+    hstats->valid = 1;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	util = mem_heapsize_r(hh->mem) ? 
+	    (double)total_size / mem_heapsize_r(hh->mem) : 1.0;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_halloc */
+	    if ((handles[index] = mm_halloc(hh, size)) == MM_HNULL)
+		app_error("mm_halloc failed in eval_mm_handles");
+	    memset(mm_hderef(hh, handles[index]), index & 0xFF, size);
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC: /* mm_hrealloc */
+	    if (mm_hrealloc(hh, handles[index], size) == MM_HNULL)
+		app_error("mm_hrealloc failed in eval_mm_handles");
+	    memset(mm_hderef(hh, handles[index]), index & 0xFF, size);
+	    total_size += size - trace->block_sizes[index];
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* mm_hfree */
+	    p = mm_hderef(hh, handles[index]);
+	    size = trace->block_sizes[index];
+	    if (hstats->valid && (p[0] != (char)(index & 0xFF) ||
+				  p[size-1] != (char)(index & 0xFF))) {
+		malloc_error(tracenum, i, "compaction did not preserve the "
+			     "data of a block");
+		hstats->valid = 0;
+	    }
+	    mm_hfree(hh, handles[index]);
+	    total_size -= size;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handles");
+        }
+
+	max_total_size = (total_size > max_total_size) ? 
+	    total_size : max_total_size;
+
+	/* Sample utilization at the edges of each compaction cycle */
+	if (!running && (hh->scan != NULL || hh->cycles > cycles)) {
+	    util_before += util;
+	    started++;
+	}
+	if (hh->cycles > cycles)
+	    util_after += mem_heapsize_r(hh->mem) ? 
+		(double)total_size / mem_heapsize_r(hh->mem) : 1.0;
+	running = (hh->scan != NULL);
+	cycles = hh->cycles;
+    }
+
+    hstats->cycles = cycles;
+    hstats->util = (double)max_total_size / mem_peaksize_r(hh->mem);
+    hstats->util_before = started ? util_before / started : 0;
+    hstats->util_after = cycles ? util_after / cycles : 0;
+    hstats->moved = hh->moved;
+    mm_hheap_destroy(hh);
+    free(handles);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -836,6 +1902,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
     int i, newsize;
     char *p, *newp, *oldp;
 
+    clear_blocks(trace);
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
@@ -866,6 +1933,9 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	}
     }
 
+    /* Unlike the mm heap, the libc heap is not reset between runs */
+    for (i = 0; i < trace->leaked; i++)
+	free(trace->blocks[trace->leaks[i]]);
     return 1;
 }
 
@@ -881,6 +1951,7 @@ static void eval_libc_speed(void *ptr)
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
+    clear_blocks(trace);
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
@@ -908,6 +1979,8 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	}
     }
+    for (i = 0; i < trace->leaked; i++)
+	free(trace->blocks[trace->leaks[i]]);
 }
 
 /*************************************
@@ -972,6 +2045,34 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printextended - prints the share of the ops and the leaked blocks of
+ *     each trace in the extended suite, and returns the utilization of
+ *     the suite with each trace weighted by its ops
+ */
+static double printextended(int n, stats_t *stats, char **tracefiles)
+{
+    int i;
+    double secs = 0, ops = 0, util = 0;
+
+    for (i = 0; i < n; i++) {
+	secs += stats[i].secs;
+	ops += stats[i].ops;
+    }
+    printf("Extended suite, weighted by ops:\n");
+    printf("%-16s%8s%8s%6s%7s%8s\n", 
+	   "trace", "ops", "weight", "util", "Kops", "leaked");
+    for (i = 0; i < n; i++) {
+	printf("%-16s%8.0f%7.1f%%%5.0f%%%7.0f%8d\n", tracefiles[i], 
+	       stats[i].ops, stats[i].ops*100.0/ops, stats[i].util*100.0, 
+	       (stats[i].ops/1e3)/stats[i].secs, stats[i].leaked);
+	util += stats[i].util * stats[i].ops/ops;
+    }
+    printf("%-16s%8.0f%8s%5.0f%%%7.0f\n\n", 
+	   "Weighted", ops, "", util*100.0, (ops/1e3)/secs);
+    return util;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -999,19 +2100,199 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * write_bench - Save the benchmark of each valid trace, including every
+ *     sample, as JSON so a later build can be compared against it
+ */
+static void write_bench(char *path, char **tracefiles, int n, 
+			stats_t *stats, fbench_t *bench)
+{
+    FILE *fp;
+    int i, j, written = 0;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	unix_error("Could not open the benchmark file");
+    fprintf(fp, "{\n  \"traces\": [");
+    for (i=0; i < n; i++) {
+	if (bench[i].n == 0)
+	    continue;
+	fprintf(fp, "%s\n    {\"file\": \"%s\", \"ops\": %.0f, "
+		"\"median\": %.9f, \"mad\": %.9f, \"lo\": %.9f, \"hi\": %.9f,\n"
+		"     \"samples\": [", written++ ? "," : "", tracefiles[i], stats[i].ops,
+		bench[i].median, bench[i].mad, bench[i].lo, bench[i].hi);
+	for (j = 0; j < bench[i].n; j++)
+	    fprintf(fp, "%s%.9f", j ? ", " : "", bench[i].samples[j]);
+	fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+/*
+ * read_bench - Load the samples of each trace from a file written by
+ *     write_bench. Traces missing from the file get no samples.
+ *     Returns the number of traces found, or -1 if the file can't be
+ *     read.
+ */
+static int read_bench(char *path, char **tracefiles, int n, fbench_t *bench)
+{
+    FILE *fp;
+    char *buf, *p, *end, key[MAXLINE];
+    long len;
+    int i, found = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((buf = malloc(len + 1)) == NULL || fread(buf, 1, len, fp) != len) {
+	fclose(fp);
+	free(buf);
+	return -1;
+    }
+    buf[len] = '\0';
+    fclose(fp);
+
+    for (i=0; i < n; i++) {
+	snprintf(key, MAXLINE, "\"file\": \"%s\"", tracefiles[i]);
+	if ((p = strstr(buf, key)) == NULL || 
+	    (p = strstr(p, "\"median\": ")) == NULL)
+	    continue;
+	bench[i].median = strtod(p + strlen("\"median\": "), NULL);
+	if ((p = strstr(p, "\"samples\": [")) == NULL)
+	    continue;
+	p = strchr(p, '[') + 1;
+	bench[i].samples = malloc((strchr(p, ']') - p) * sizeof(double));
+	if (bench[i].samples == NULL)
+	    unix_error("read_bench malloc failed");
+	bench[i].n = 0;
+	while (*p != ']') {
+	    bench[i].samples[bench[i].n] = strtod(p, &end);
+	    if (end == p)
+		break;
+	    bench[i].n++;
+	    for (p = end; *p == ',' || *p == ' ' || *p == '\n'; p++)
+		;
+	}
+	found++;
+    }
+    free(buf);
+    return found;
+}
+
+/*
+ * printcounters - Print the instructions per cycle and the hardware
+ *     events per operation of each trace. Events the CPU can't count
+ *     are shown as "-".
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, j;
+    long long *c;
+
+    printf("%5s%8s%6s", "trace", "ops", "IPC");
+    for (j = 0; j < FPERF_NEVENTS; j++)
+	if (j != FPERF_INSTRUCTIONS)
+	    printf("%8.6s", fperf_names[j]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	c = stats[i].counts;
+	printf("%2d%11.0f", i, stats[i].ops);
+	if (stats[i].valid && c[FPERF_CYCLES] > 0 && c[FPERF_INSTRUCTIONS] >= 0)
+	    printf("%6.2f", (double)c[FPERF_INSTRUCTIONS]/c[FPERF_CYCLES]);
+	else
+	    printf("%6s", "-");
+	for (j = 0; j < FPERF_NEVENTS; j++) {
+	    if (j == FPERF_INSTRUCTIONS)
+		continue;
+	    if (stats[i].valid && c[j] >= 0)
+		printf("%8.2f", c[j]/stats[i].ops);
+	    else
+		printf("%8s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printbench - Print the median, MAD and confidence interval of each
+ *     trace and, if base is given, the relative change from base with
+ *     a verdict on whether it is significant. Returns the number of
+ *     significant regressions.
+ */
+static int printbench(int n, stats_t *stats, fbench_t *bench, 
+		      fbench_t *base, char *basefile)
+{
+    int i, verdict, regressions = 0;
+    double lo, hi;
+
+    printf("Benchmark of mm malloc, %s:\n", BENCHFILE);
+    printf("%5s%8s%12s%12s%25s%7s\n", 
+	   "trace", "ops", "median", "MAD", "95% CI", "Kops");
+    for (i=0; i < n; i++) {
+	if (bench[i].n == 0)
+	    printf("%2d%11.0f%12s%12s%25s%7s\n", i, stats[i].ops,
+		   "-", "-", "-", "-");
+	else
+	    printf("%2d%11.0f%12.6f%12.6f  [%9.6f, %9.6f]%7.0f\n", i, 
+		   stats[i].ops, bench[i].median, bench[i].mad, 
+		   bench[i].lo, bench[i].hi, 
+		   (stats[i].ops/1e3)/bench[i].median);
+    }
+    if (basefile == NULL)
+	return 0;
+
+    printf("\nCompared with %s:\n", basefile);
+    printf("%5s%12s%12s%9s%21s  %s\n", 
+	   "trace", "base", "new", "change", "95% CI", "verdict");
+    for (i=0; i < n; i++) {
+	if (bench[i].n == 0 || base[i].n == 0) {
+	    printf("%2d%15s%12s%9s%21s  %s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	verdict = fbench_compare(base[i].samples, base[i].n, 
+				 bench[i].samples, bench[i].n, &lo, &hi);
+	if (verdict > 0)
+	    regressions++;
+	printf("%2d%15.6f%12.6f%+8.1f%%   [%+6.1f%%, %+6.1f%%]  %s\n", i, 
+	       base[i].median, bench[i].median, 
+	       (bench[i].median/base[i].median - 1)*100.0, lo*100.0, hi*100.0,
+	       verdict > 0 ? "REGRESSION" : verdict < 0 ? "faster" : "same");
+    }
+    return regressions;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcmszEGHLOPRT] [-f <file>] [-t <dir>] [-p <n>]\n");
+    fprintf(stderr, "               [-B <n>] [-C <cpu>] [-X <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <n>     Benchmark each trace with <n> timed runs.\n");
+    fprintf(stderr, "\t-c         Count cycles, cache and TLB misses per op.\n");
+    fprintf(stderr, "\t-C <cpu>   Pin the driver to CPU <cpu>.\n");
+    fprintf(stderr, "\t-E         Score the real program traces, weighted by ops.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G         Measure garbage collection pause times.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Evaluate the handle-based allocator.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Check and time the size class lookup.\n");
+    fprintf(stderr, "\t-m         Time each trace with cold, warm and steady caches.\n");
+    fprintf(stderr, "\t-O         Compare the pool allocator with mm_malloc.\n");
+    fprintf(stderr, "\t-p <n>     Profile the heap, sampling every <n> bytes.\n");
+    fprintf(stderr, "\t-P         Back the heap with huge pages.\n");
+    fprintf(stderr, "\t-R         Follow the resident heap memory through a few traces.\n");
+    fprintf(stderr, "\t-s         Print the allocator statistics of each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Count dTLB misses with 4K and huge pages.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-X <file>  Compare the benchmark with an earlier one.\n");
+    fprintf(stderr, "\t-z         Compare profiled and power-of-two size classes.\n");
 }
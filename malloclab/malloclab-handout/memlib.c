@@ -2,6 +2,11 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Each simulated heap is a mem_t with its own region and brk
+ *            pointer.  The driver uses a single default heap through the
+ *            original mem_init/mem_sbrk/... interface; allocators that want
+ *            several independent heaps use the *_r versions instead.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,82 +19,277 @@
 #include "memlib.h"
 #include "config.h"
 
+/* Rounds p down or up to a page boundary */
+#define PAGE_DOWN(p) ((char *)((size_t)(p) & ~(mem_pagesize() - 1)))
+#define PAGE_UP(p)   PAGE_DOWN((char *)(p) + mem_pagesize() - 1)
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_t *mem_heap = NULL;  /* the default heap */
+static int hugepages = 0;       /* back new heaps with huge pages? */
+
+/*
+ * map_hugepages - map maxsize bytes aligned to a huge page and ask the
+ *     kernel to back them with transparent huge pages. Returns the start
+ *     of the region and its length in *len, or NULL on failure.
+ */
+static char *map_hugepages(size_t maxsize, size_t *len)
+{
+    char *p, *start;
+    size_t head;
+
+    /* Over-map by one huge page, then trim to an aligned region */
+    *len = (maxsize + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+    p = mmap(NULL, *len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    start = (char *)(((size_t)p + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1));
+    head = start - p;
+    if (head > 0)
+	munmap(p, head);
+    munmap(start + *len, HUGEPAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, *len, MADV_HUGEPAGE) < 0)
+	fprintf(stderr, "mem_create: madvise(MADV_HUGEPAGE) failed: %s\n",
+		strerror(errno));
+#endif
+    return start;
+}
+
+/*
+ * set_mem_hugepages - back heaps created from now on with huge pages
+ */
+void set_mem_hugepages(int on)
+{
+    hugepages = on;
+}
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_create - create a new simulated heap of at most maxsize bytes
  */
-void mem_init(void)
+mem_t *mem_create(size_t maxsize)
 {
+    mem_t *m;
+
+    if ((m = (mem_t *)malloc(sizeof(mem_t))) == NULL) {
+	fprintf(stderr, "mem_create: malloc error\n");
+	exit(1);
+    }
+
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    m->map_len = 0;
+    if (hugepages) {
+	if ((m->start_brk = map_hugepages(maxsize, &m->map_len)) == NULL) {
+	    fprintf(stderr, "mem_init_vm: mmap error\n");
+	    exit(1);
+	}
+    }
+    else if ((m->start_brk = (char *)malloc(maxsize)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    m->max_addr = m->start_brk + maxsize;  /* max legal heap address */
+    m->brk = m->start_brk;                 /* heap is empty initially */
+    m->peak_brk = m->start_brk;
+    return m;
 }
 
 /* 
- * mem_deinit - free the storage used by the memory system model
+ * mem_destroy - release a simulated heap and everything allocated in it
  */
-void mem_deinit(void)
+void mem_destroy(mem_t *m)
 {
-    free(mem_start_brk);
+    if (m->map_len)
+	munmap(m->start_brk, m->map_len);
+    else
+	free(m->start_brk);
+    free(m);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk_r - reset the simulated brk pointer to make an empty heap
  */
-void mem_reset_brk()
+void mem_reset_brk_r(mem_t *m)
 {
-    mem_brk = mem_start_brk;
+    m->brk = m->start_brk;
+    m->peak_brk = m->start_brk;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_sbrk_r - simple model of the sbrk function. Extends the heap 
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, gives the whole pages above the
+ *    new brk back to the OS like a real sbrk, and returns the old brk.
+ *    The peak brk is remembered so utilization is still measured
+ *    against the high water mark.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk_r(mem_t *m, int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = m->brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((m->brk + incr) < m->start_brk) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below heap start...\n");
+	return (void *)-1;
+    }
+    if ((m->brk + incr) > m->max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    m->brk += incr;
+    if (m->brk > m->peak_brk)
+	m->peak_brk = m->brk;
+    if (incr < 0)
+	mem_release_r(m, m->brk, -incr);
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_heap_lo_r - return address of the first heap byte
+ */
+void *mem_heap_lo_r(mem_t *m)
+{
+    return (void *)m->start_brk;
+}
+
+/* 
+ * mem_heap_hi_r - return address of last heap byte
+ */
+void *mem_heap_hi_r(mem_t *m)
+{
+    return (void *)(m->brk - 1);
+}
+
+/*
+ * mem_heapsize_r - returns the heap size in bytes
+ */
+size_t mem_heapsize_r(mem_t *m) 
+{
+    return (size_t)(m->brk - m->start_brk);
+}
+
+/*
+ * mem_peaksize_r - returns the largest heap size since the last reset
+ */
+size_t mem_peaksize_r(mem_t *m) 
+{
+    return (size_t)(m->peak_brk - m->start_brk);
+}
+
+/*
+ * mem_release_r - tell the memory system that [lo, lo+len) of heap m
+ *    holds no data. The whole pages inside the range are given back
+ *    to the OS with madvise(MADV_DONTNEED) and read as zeros when
+ *    touched again. Returns the number of bytes released.
+ */
+size_t mem_release_r(mem_t *m, void *lo, size_t len)
+{
+    char *start = PAGE_UP(lo);
+    char *end = PAGE_DOWN((char *)lo + len);
+
+    if (start < PAGE_UP(m->start_brk))
+	start = PAGE_UP(m->start_brk);
+    if (end > PAGE_DOWN(m->max_addr))
+	end = PAGE_DOWN(m->max_addr);
+    if (end <= start || madvise(start, end - start, MADV_DONTNEED) < 0)
+	return 0;
+    return (size_t)(end - start);
+}
+
+/*
+ * mem_resident_r - returns the bytes of heap m, up to its maximum size,
+ *    that are in physical memory
+ */
+size_t mem_resident_r(mem_t *m)
+{
+    char *start = PAGE_UP(m->start_brk);
+    size_t npages = (PAGE_DOWN(m->max_addr) - start) / mem_pagesize();
+    size_t i, resident = 0;
+    unsigned char *vec;
+
+    if ((vec = malloc(npages)) == NULL)
+	return 0;
+    if (mincore(start, npages * mem_pagesize(), vec) == 0)
+	for (i = 0; i < npages; i++)
+	    resident += vec[i] & 1;
+    free(vec);
+    return resident * mem_pagesize();
+}
+
+/* 
+ * mem_init - initialize the default heap
+ */
+void mem_init(void)
+{
+    mem_heap = mem_create(MAX_HEAP);
+}
+
+/* 
+ * mem_deinit - free the storage used by the default heap
+ */
+void mem_deinit(void)
+{
+    mem_destroy(mem_heap);
+    mem_heap = NULL;
+}
+
+/*
+ * mem_default - return the default heap created by mem_init
+ */
+mem_t *mem_default(void)
+{
+    return mem_heap;
+}
+
+/*
+ * mem_reset_brk - reset the default heap to empty
+ */
+void mem_reset_brk()
+{
+    mem_reset_brk_r(mem_heap);
+}
+
+/* 
+ * mem_sbrk - extend the default heap by incr bytes
+ */
+void *mem_sbrk(int incr) 
+{
+    return mem_sbrk_r(mem_heap, incr);
+}
+
+/*
+ * mem_heap_lo - return address of the first byte of the default heap
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_r(mem_heap);
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last byte of the default heap
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_r(mem_heap);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the default heap size in bytes
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_heapsize_r(mem_heap);
+}
+
+/*
+ * mem_peaksize() - returns the peak size of the default heap in bytes
+ */
+size_t mem_peaksize() 
+{
+    return mem_peaksize_r(mem_heap);
 }
 
 /*
@@ -1,11 +1,50 @@
+#ifndef __MEMLIB_H_
+#define __MEMLIB_H_
+
 #include <unistd.h>
 
-void mem_init(void);               
+/*
+ * mem_t - one simulated heap. Every heap owns a private region and
+ * brk pointer, so any number of them can coexist in a process and
+ * each one is released as a whole by mem_destroy.
+ */
+typedef struct {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */
+    char *peak_brk;   /* highest brk since the heap was last reset */
+    size_t map_len;   /* length of the huge-page mapping, 0 if malloc'd */
+} mem_t;
+
+/* 
+ * set_mem_hugepages - When set, heaps created afterwards are backed by
+ *     a 2 MB-aligned mmap region advised for transparent huge pages.
+ *     Default = 0
+ */
+void set_mem_hugepages(int on);
+
+/* Explicit-heap interface */
+mem_t *mem_create(size_t maxsize);
+void mem_destroy(mem_t *m);
+void *mem_sbrk_r(mem_t *m, int incr);
+void mem_reset_brk_r(mem_t *m);
+void *mem_heap_lo_r(mem_t *m);
+void *mem_heap_hi_r(mem_t *m);
+size_t mem_heapsize_r(mem_t *m);
+size_t mem_peaksize_r(mem_t *m);
+size_t mem_release_r(mem_t *m, void *lo, size_t len);
+size_t mem_resident_r(mem_t *m);
+
+/* Default-heap interface, used by the driver */
+void mem_init(void);
 void mem_deinit(void);
+mem_t *mem_default(void);
 void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peaksize(void);
 size_t mem_pagesize(void);
 
+#endif /* __MEMLIB_H_ */
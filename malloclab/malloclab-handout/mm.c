@@ -9,14 +9,21 @@
  * NOTE TO STUDENTS: Replace this header comment with your own header
  * comment that gives a high level description of your solution.
  */
+#define _GNU_SOURCE  /* pthread_getattr_np */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <setjmp.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mmprof.h"
+#include "sizeclasses.h"
 
 team_t team = {
     "----------",
@@ -32,9 +39,6 @@ team_t team = {
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
-
-
 #define WSIZE 4
 #define DSIZE 8
 #define CHUNKSIZE (1<<12)
@@ -50,6 +54,15 @@ team_t team = {
 #define GET_SIZE(p)   (GET(p) & ~0x7)
 #define GET_ALLOC(p)  (GET(p) & 0x1)
 
+/* Mark bit of an allocated block's header, only set during mm_gc_collect */
+#define GET_MARK(p)   (GET(p) & 0x2)
+#define SET_MARK(p)   PUT(p, GET(p) | 0x2)
+#define CLR_MARK(p)   PUT(p, GET(p) & ~0x2)
+
+/* Sampled bit of an allocated block's header, set for heap profiler samples */
+#define GET_SAMPLED(p) (GET(p) & 0x4)
+#define SET_SAMPLED(p) PUT(p, GET(p) | 0x4)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)      ((char *)(bp) - WSIZE)
 #define FTRP(bp)      ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -64,77 +77,191 @@ team_t team = {
 
 /* 
  * Given a FREE block ptr bp, compute the address of pred and succ FIELDS
- * See p.862 of CSAPP:3e, free list format
+ * See p.862 of CSAPP:3e, free list format. The links are stored as
+ * offsets from the start of the heap, so they fit in a word; 0 = none.
  */
-#define GET_PREDP(bp) bp
-#define GET_SUCCP(bp) (bp + WSIZE)
+#define GET_PREDP(bp) ((char *)(bp))
+#define GET_SUCCP(bp) ((char *)(bp) + WSIZE)
 
+/*
+ * purge_heap stamps each block on the large lists with the pass that
+ * first saw it and its size then; a block that still has the stamp of
+ * the previous pass has stayed free since. PURGED marks a block whose
+ * pages have been given back.
+ */
+#define GET_AGEP(bp)   ((char *)(bp) + 2*WSIZE)
+#define GET_AGESZP(bp) ((char *)(bp) + 3*WSIZE)
+#define PURGED         0xffffffffu
 
-#define FIRST_FIT 0
-#define NEXT_FIT 1
-#define BEST_FIT 2
+#define OFFSET(h, bp) ((unsigned int)((char *)(bp) - (h)->mem->start_brk))
+#define BLOCK(h, off) ((h)->mem->start_brk + (off))
 
-#define FIT_STRATEGY FIRST_FIT
-// #define FIT_STRATEGY NEXT_FIT
-// #define FIT_STRATEGY BEST_FIT
 
-static void *heap_listp;
+/* Blocks up to this size are placed at the low end of a free block */
+#define SMALL_BLOCK 256
 
-static void *first_fit(size_t size) {
-  void *bp = heap_listp;
-  while (GET_SIZE(HDRP(bp)) != 0) {
-    bp = NEXT_BLKP(bp);
-    if (GET_SIZE(HDRP(bp)) >= size && !GET_ALLOC(HDRP(bp)))  // first fit
-      return bp;
-  }
-  return NULL;
+/* Mallocs and frees between two looks at the clock for a purge pass */
+#define PURGE_CHECK 64
+
+#if SC_NCLASSES > MM_MAXCLASSES
+#error "sizeclasses.h has more classes than MM_MAXCLASSES"
+#endif
+
+/* Generic power-of-two classes, the default; see mdriver -z */
+static const unsigned int pow2_limits[] = {
+  8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096
+};
+#define POW2_NCLASSES ((int)(sizeof(pow2_limits) / sizeof(pow2_limits[0])))
+
+/* The heap used by mm_init/mm_malloc/mm_free/mm_realloc */
+static mm_heap_t mm_heap = {
+  .trim = MM_TRIM_DEFAULT, .decay_ms = MM_DECAY_DEFAULT
+};
+
+/* floor(log2(x)) for x > 0, with one count-leading-zeros instruction */
+#define LOG2(x) (31 - __builtin_clz((unsigned int)(x)))
+
+/*
+ * size_class - Return the class of an aligned request of asize bytes,
+ *     the first one whose limit is at least asize, or -1 if asize is
+ *     larger than every class. Profiled classes are looked up in the
+ *     generated table up to SC_LUTMAX, which fits in a few cache lines,
+ *     and scanned from there on; power-of-two classes are computed
+ *     with LOG2.
+ */
+static int size_class(mm_heap_t *h, size_t asize) {
+  int c;
+
+  if (asize > h->limits[h->nclasses - 1])
+    return -1;
+  if (h->limits == pow2_limits)
+    return asize <= 8 ? 0 : LOG2(asize - 1) - 2;
+  if (asize <= SC_LUTMAX)
+    return sc_class[asize / ALIGNMENT];
+  for (c = sc_class[SC_LUTMAX / ALIGNMENT]; sc_limits[c] < asize; c++)
+    ;
+  return c;
 }
 
-static void *next_fit(size_t size) {
-  return first_fit(size);
-  // void *bp = heap_listp;
-  // while (GET_SIZE(HDRP(bp)) != 0) {
-  //   bp = NEXT_BLKP(bp);
-  //   if (GET_SIZE(HDRP(bp)) >= size && !GET_ALLOC(HDRP(bp)))  // first fit
-  //     return bp;
-  // }
-  // return NULL;
+/*
+ * list_of - Return the free list of a free block of bsize bytes. Blocks
+ *     that can hold the requests of a class but not of the next one go
+ *     on that class's list, so the head of any list at or above the
+ *     class of a request fits it. Blocks larger than every class go on
+ *     a large list by the log2 of their payload. Returns -1 for blocks
+ *     too small for any class; those stay off the lists until they are
+ *     coalesced.
+ */
+static int list_of(mm_heap_t *h, size_t bsize) {
+  size_t cap = bsize - DSIZE;
+  int c;
+
+  if (cap > h->limits[h->nclasses - 1])
+    return MM_MAXCLASSES + LOG2(cap);
+  c = size_class(h, cap);
+  return h->limits[c] > cap ? c - 1 : c;
 }
 
-static void *best_fit(size_t size) {
-  void *best = NULL;
-  size_t best_diff = -1;
-  void *bp = heap_listp;
-  while (GET_SIZE(HDRP(bp)) != 0) {
-    bp = NEXT_BLKP(bp);
-    if (!GET_ALLOC(HDRP(bp))) { // best fit
-      size_t bsize = GET_SIZE(HDRP(bp));
-      if (bsize > size && bsize - size < best_diff) {
-        best = bp;
-        best_diff = bsize - size;
-      }
-    }
+/* insert_block - Push free block bp on the front of its list */
+static void insert_block(mm_heap_t *h, void *bp) {
+  int i = list_of(h, GET_SIZE(HDRP(bp)));
+  unsigned int head;
+
+  if (i < 0)
+    return;
+  head = h->lists[i];
+  PUT(GET_PREDP(bp), 0);
+  PUT(GET_SUCCP(bp), head);
+  if (head)
+    PUT(GET_PREDP(BLOCK(h, head)), OFFSET(h, bp));
+  h->lists[i] = OFFSET(h, bp);
+}
+
+/* remove_block - Unlink free block bp from its list */
+static void remove_block(mm_heap_t *h, void *bp) {
+  int i = list_of(h, GET_SIZE(HDRP(bp)));
+  unsigned int pred, succ;
+
+  if (i < 0)
+    return;
+  pred = GET(GET_PREDP(bp));
+  succ = GET(GET_SUCCP(bp));
+  if (pred)
+    PUT(GET_SUCCP(BLOCK(h, pred)), succ);
+  else
+    h->lists[i] = succ;
+  if (succ)
+    PUT(GET_PREDP(BLOCK(h, succ)), pred);
+}
+
+/*
+ * find_fit - Return a free block for an aligned request of asize
+ *     bytes, or NULL. A request within the classes takes the head of
+ *     the first non-empty list at or above its class. A larger request
+ *     searches its own large list first fit, then takes the head of
+ *     any larger one.
+ */
+static void *find_fit(mm_heap_t *h, size_t asize) {
+  int c = size_class(h, asize), i;
+  unsigned int off;
+
+  if (c >= 0) {
+    for (i = c; i < h->nclasses; i++)
+      if (h->lists[i])
+        return BLOCK(h, h->lists[i]);
+    i = MM_MAXCLASSES;
+  } else {
+    i = MM_MAXCLASSES + LOG2(asize);
+    for (off = h->lists[i]; off; off = GET(GET_SUCCP(BLOCK(h, off))))
+      if (GET_SIZE(HDRP(BLOCK(h, off))) >= asize + DSIZE)
+        return BLOCK(h, off);
+    i++;
   }
-  return best;
+  for (; i < MM_MAXCLASSES + MM_NLARGE; i++)
+    if (h->lists[i])
+      return BLOCK(h, h->lists[i]);
+  return NULL;
 }
 
-static void place (void *bp, size_t size) {
+/*
+ * place - Allocate size bytes of free block bp, splitting off the rest.
+ *     Small blocks are carved from the low end of the free block and
+ *     large ones from the high end, so small blocks stay packed together
+ *     at low addresses and share TLB entries (and huge pages). Returns
+ *     the payload of the allocated block.
+ */
+static void *place (mm_heap_t *h, void *bp, size_t size) {
   size_t bsize = GET_SIZE(HDRP(bp));
   size_t remain = bsize - size;
 
+  remove_block(h, bp);
   if (remain < 2*DSIZE) {  // no split
     PUT(HDRP(bp), PACK(bsize, 1));
     PUT(FTRP(bp), PACK(bsize, 1));
-  } else {  // split
+  } else if (size <= SMALL_BLOCK) {  // split, allocate the low end
     PUT(HDRP(bp), PACK(size, 1));
     PUT(FTRP(bp), PACK(size, 1));
-    bp = NEXT_BLKP(bp);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(remain, 0));
+    PUT(FTRP(NEXT_BLKP(bp)), PACK(remain, 0));
+    insert_block(h, NEXT_BLKP(bp));
+    h->stats.splits++;
+  } else {  // split, allocate the high end
     PUT(HDRP(bp), PACK(remain, 0));
     PUT(FTRP(bp), PACK(remain, 0));
+    insert_block(h, bp);
+    h->stats.splits++;
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(size, 1));
+    PUT(FTRP(bp), PACK(size, 1));
   }
+  return bp;
 }
 
-static void *coalesce(void *bp) {
+/*
+ * coalesce - Merge free block bp, which is on no list, with its free
+ *     neighbors and put the result on its list.
+ */
+static void *coalesce(mm_heap_t *h, void *bp) {
   size_t size = GET_SIZE(HDRP(bp));
 
   const void *prev_ftr = PREV_FTRP(bp);
@@ -142,6 +269,8 @@ static void *coalesce(void *bp) {
 
   /* Coalesce with next free block */
   if (!GET_ALLOC(next_hdr)) {
+    remove_block(h, NEXT_BLKP(bp));
+    h->stats.coalesces++;
     size += GET_SIZE(next_hdr);
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
@@ -149,117 +278,703 @@ static void *coalesce(void *bp) {
 
   /* Coalesce with prev free block */
   if (!GET_ALLOC(prev_ftr)) {
+    remove_block(h, PREV_BLKP(bp));
+    h->stats.coalesces++;
     size += GET_SIZE(prev_ftr);
     bp = PREV_BLKP(bp);
     PUT(HDRP(bp), PACK(size, 0));
     PUT(FTRP(bp), PACK(size, 0));
   }
 
+  insert_block(h, bp);
   return bp;
 }
 
-static void *extend_heap(size_t size) {
+/*
+ * shrink_block - Cut allocated block bp down to bsize bytes, or leave
+ *     it whole if the rest is too small to be a free block. The rest
+ *     is freed and coalesced with the block after it.
+ */
+static void shrink_block(mm_heap_t *h, void *bp, size_t bsize) {
+  size_t remain = GET_SIZE(HDRP(bp)) - bsize;
+
+  if (remain < 2*DSIZE)
+    return;
+  PUT(HDRP(bp), PACK(bsize, GET(HDRP(bp)) & 0x7));  // keep the sampled bit
+  PUT(FTRP(bp), PACK(bsize, 1));
+  bp = NEXT_BLKP(bp);
+  PUT(HDRP(bp), PACK(remain, 0));
+  PUT(FTRP(bp), PACK(remain, 0));
+  h->stats.splits++;
+  coalesce(h, bp);
+}
+
+static void *extend_heap(mm_heap_t *h, size_t size) {
   void *bp;
   size_t newsize = ALIGN(size);
 
-  if ((bp = mem_sbrk(newsize)) == (void *)-1)
+  if ((bp = mem_sbrk_r(h->mem, newsize)) == (void *)-1)
     return NULL;
+  h->stats.sbrks++;
 
   PUT(HDRP(bp), PACK(size, 0));           // block header (overwrite old epilogue header)
   PUT(FTRP(bp), PACK(size, 0));           // block footer
   PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   // new epilogue header
 
   /* Possible coalesce with previous free block */
-  return coalesce(bp);
+  return coalesce(h, bp);
+}
+
+/*
+ * trim_heap - Shrink the heap so that its free top block bp, which is
+ *     at least twice the trim threshold, keeps the threshold. The slack
+ *     keeps a heap that breathes around its top from trimming and
+ *     growing back on every other request.
+ */
+static void trim_heap(mm_heap_t *h, void *bp) {
+  size_t size = GET_SIZE(HDRP(bp));
+  size_t keep = ALIGN(MAX(h->trim, CHUNKSIZE));
+
+  remove_block(h, bp);
+  PUT(HDRP(bp), PACK(keep, 0));
+  PUT(FTRP(bp), PACK(keep, 0));
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   // new epilogue header
+  insert_block(h, bp);
+  mem_sbrk_r(h->mem, -(int)(size - keep));
+  h->stats.trimmed += size - keep;
+}
+
+/* now_ms - Milliseconds on the monotonic clock */
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* is_old - Has free block bp stayed free since the previous pass? */
+static int is_old(mm_heap_t *h, void *bp) {
+  return GET(GET_AGESZP(bp)) == GET_SIZE(HDRP(bp)) &&
+    GET(GET_AGEP(bp)) == h->purge_epoch - 1;
+}
+
+/*
+ * purge_heap - Give back the memory of the large free blocks that have
+ *     stayed free since the previous pass, which ran at least decay_ms
+ *     ago. A block at the top of the heap is trimmed if it is large
+ *     enough; the pages inside the others are released, and their
+ *     headers, links and footers stay put. The blocks that are not old
+ *     enough yet are stamped for the next pass.
+ */
+static void purge_heap(mm_heap_t *h) {
+  unsigned int off;
+  char *bp = PREV_BLKP((char *)mem_heap_hi_r(h->mem) + 1);
+  int i;
+
+  if (h->trim && !GET_ALLOC(HDRP(bp)) &&
+      GET_SIZE(HDRP(bp)) >= 2 * MAX(h->trim, CHUNKSIZE) && is_old(h, bp))
+    trim_heap(h, bp);
+
+  for (i = MM_MAXCLASSES; i < MM_MAXCLASSES + MM_NLARGE; i++) {
+    for (off = h->lists[i]; off; off = GET(GET_SUCCP(bp))) {
+      bp = BLOCK(h, off);
+      if (GET(GET_AGEP(bp)) == PURGED && 
+          GET(GET_AGESZP(bp)) == GET_SIZE(HDRP(bp)))
+        continue;
+      if (is_old(h, bp)) {
+        h->stats.purged += mem_release_r(h->mem, GET_AGESZP(bp) + WSIZE,
+                                         FTRP(bp) - (GET_AGESZP(bp) + WSIZE));
+        PUT(GET_AGEP(bp), PURGED);
+      } else {
+        PUT(GET_AGEP(bp), h->purge_epoch);
+        PUT(GET_AGESZP(bp), GET_SIZE(HDRP(bp)));
+      }
+    }
+  }
+  h->purge_epoch = (h->purge_epoch + 1) & (PURGED >> 1);
+  if (h->purge_epoch == 0)
+    h->purge_epoch = 1;
+}
+
+/*
+ * purge_tick - Run a purge pass if decay_ms have passed since the last.
+ */
+static void purge_tick(mm_heap_t *h) {
+  long now;
+
+  h->purge_countdown = PURGE_CHECK;
+  if (h->decay_ms >= 0 && (now = now_ms()) - h->purge_last >= h->decay_ms) {
+    purge_heap(h);
+    h->purge_last = now;
+  }
+}
+
+/*
+ * mm_heap_create - create an independent heap of at most maxsize bytes.
+ *     The heap must still be initialized with mm_init_r before use.
+ */
+mm_heap_t *mm_heap_create(size_t maxsize)
+{
+    mm_heap_t *h;
+
+    if ((h = calloc(1, sizeof(mm_heap_t))) == NULL)
+      return NULL;
+    h->mem = mem_create(maxsize);
+    h->trim = MM_TRIM_DEFAULT;
+    h->decay_ms = MM_DECAY_DEFAULT;
+    return h;
+}
+
+/*
+ * mm_heap_destroy - release a heap created by mm_heap_create together
+ *     with every block still allocated in it. No per-block work is done.
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+    mmprof_forget_range(h->mem->start_brk, h->mem->max_addr);
+    mem_destroy(h->mem);
+    free(h->gc_roots);
+    free(h);
 }
 
 /* 
- * mm_init - initialize the malloc package.
+ * mm_init_r - initialize heap h. Its memory must be empty, either freshly
+ *     created or reset with mem_reset_brk_r.
  */
-int mm_init(void)
+int mm_init_r(mm_heap_t *h)
 {
-    if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
+    char *p;
+
+    /* Blocks of a reset heap were never freed; drop their samples */
+    mmprof_forget_range(h->mem->start_brk, h->mem->max_addr);
+
+    if ((p = mem_sbrk_r(h->mem, 4*WSIZE)) == (void *)-1)
       return -1;
 
-    PUT(heap_listp, 0);                           // padding
-    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1));  // prologue header
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1));  // prologue footer
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1));      // epilogue header
-    heap_listp += DSIZE;
+    PUT(p, 0);                           // padding
+    PUT(p + (1*WSIZE), PACK(DSIZE, 1));  // prologue header
+    PUT(p + (2*WSIZE), PACK(DSIZE, 1));  // prologue footer
+    PUT(p + (3*WSIZE), PACK(0, 1));      // epilogue header
+    h->heap_listp = p + DSIZE;
+
+    memset(h->lists, 0, sizeof(h->lists));
+    memset(&h->stats, 0, sizeof(h->stats));
+    h->purge_epoch = 1;
+    h->purge_last = now_ms();
+    h->purge_countdown = PURGE_CHECK;
+    if (h->classes == MM_CLASSES_PROFILED) {
+      h->limits = sc_limits;
+      h->nclasses = SC_NCLASSES;
+    } else {
+      h->limits = pow2_limits;
+      h->nclasses = POW2_NCLASSES;
+    }
 
     /* Initialize a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE) == NULL)
+    if (extend_heap(h, CHUNKSIZE) == NULL)
       return -1;
+    h->gc_next = 2 * mem_heapsize_r(h->mem);
     return 0;
 }
 
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * mm_init - initialize the malloc package on the memlib default heap.
+ */
+int mm_init(void)
+{
+    mm_heap.mem = mem_default();
+    return mm_init_r(&mm_heap);
+}
+
+/*
+ * mm_size_class_r - Return the free list heap h serves a request of
+ *     size bytes from: its size class, or MM_MAXCLASSES plus the log2
+ *     of its size if it is larger than every class.
+ */
+int mm_size_class_r(mm_heap_t *h, size_t size)
+{
+    size_t asize = ALIGN(size);
+    int c = size_class(h, asize);
+
+    return c >= 0 ? c : MM_MAXCLASSES + LOG2(asize);
+}
+
+/*
+ * mm_stats_r - Copy the counters of heap h into *st and fill in its
+ *     current state with a walk over the blocks. Keeping the state up
+ *     to date in insert_block and remove_block instead costs up to 10%
+ *     of the throughput of the default traces.
+ */
+void mm_stats_r(mm_heap_t *h, mm_stats_t *st)
+{
+    char *bp;
+    size_t bsize;
+    int i;
+
+    *st = h->stats;
+    st->heap_bytes = mem_heapsize_r(h->mem);
+    for (bp = NEXT_BLKP(h->heap_listp); (bsize = GET_SIZE(HDRP(bp))) > 0;
+         bp = NEXT_BLKP(bp)) {
+      if (GET_ALLOC(HDRP(bp))) {
+        st->alloc_bytes += bsize;
+        st->alloc_blocks++;
+      } else {
+        st->free_bytes += bsize;
+        st->free_blocks++;
+        if ((i = list_of(h, bsize)) >= 0)
+          st->list_blocks[i]++;
+      }
+    }
+}
+
+/*
+ * mm_stats - Copy the counters of the default heap into *st.
+ */
+void mm_stats(mm_stats_t *st)
+{
+    mm_stats_r(&mm_heap, st);
+}
+
+/*
+ * mm_set_return_r - Set how heap h gives free memory back. Once a
+ *     large free block has stayed free for decay_ms milliseconds (-1 =
+ *     never), the pages inside it are released with madvise, or if it
+ *     is at the top of the heap and at least twice trim bytes (0 =
+ *     never), the heap is cut back to trim bytes of free space with a
+ *     shrinking mem_sbrk.
+ */
+void mm_set_return_r(mm_heap_t *h, size_t trim, long decay_ms)
+{
+    h->trim = trim;
+    h->decay_ms = decay_ms;
+}
+
+/*
+ * mm_set_return - Set the memory return policy of the default heap.
+ */
+void mm_set_return(size_t trim, long decay_ms)
+{
+    mm_set_return_r(&mm_heap, trim, decay_ms);
+}
+
+/*
+ * mm_purge_r - Run the purge pass of heap h that is due, as the next
+ *     malloc or free would. A program that goes idle calls it now and
+ *     then, so that the memory it freed last is given back too: each
+ *     block needs a pass to stamp it and a later one to release it.
+ *     Returns the bytes given back.
+ */
+size_t mm_purge_r(mm_heap_t *h)
+{
+    size_t before = h->stats.purged + h->stats.trimmed;
+
+    purge_tick(h);
+    return h->stats.purged + h->stats.trimmed - before;
+}
+
+/*
+ * mm_purge - Run the purge pass of the default heap that is due.
+ */
+size_t mm_purge(void)
+{
+    return mm_purge_r(&mm_heap);
+}
+
+/*
+ * mm_set_classes_r - Select the size class table of heap h. It is used
+ *     from the next mm_init_r on.
+ */
+void mm_set_classes_r(mm_heap_t *h, int classes)
+{
+    h->classes = classes;
+}
+
+/*
+ * mm_set_classes - Select the size class table of the default heap.
+ */
+void mm_set_classes(int classes)
+{
+    mm_set_classes_r(&mm_heap, classes);
+}
+
+/* 
+ * mm_malloc_r - Allocate a block from heap h.
  *     Always allocate a block whose size is a multiple of the alignment.
+ *     Requests within the size classes are rounded up to their class.
  */
-void *mm_malloc(size_t size)
+void *mm_malloc_r(mm_heap_t *h, size_t size)
 {
     void *bp;
-    size_t newsize = ALIGN(size + SIZE_T_SIZE);
+    size_t asize = ALIGN(size);
+    size_t newsize;
+    int c;
 
     /* Ignore spurious allocations */
     if (size == 0)
       return NULL;
 
-    /* Search the free list for fit */
-#if FIT_STRATEGY == BEST_FIT
-    bp = best_fit(newsize);
-#elif FIT_STRATEGY == FIRST_FIT
-    bp = first_fit(newsize);
-#else
-    bp = next_fit(newsize);
-#endif
-    if (bp != NULL) {
-      place(bp, newsize);
-      return bp;
+    if ((c = size_class(h, asize)) >= 0)
+      asize = h->limits[c];
+    newsize = asize + DSIZE;  /* header and footer */
+
+    /* Search the free lists for fit */
+    bp = find_fit(h, asize);
+
+    /* No fit found. Reclaim garbage first if the heap has grown enough */
+    if (bp == NULL && (h->gc_flags & MM_GC_AUTO) && 
+        mem_heapsize_r(h->mem) >= h->gc_next) {
+      mm_gc_collect_r(h);
+      bp = find_fit(h, asize);
     }
 
     /* No fit found. Request more memory by calling extend_heap */
-    bp = extend_heap(MAX(newsize, CHUNKSIZE));
-    if (bp != NULL) {
-      place(bp, newsize);
-      return bp;
-    }
+    if (bp == NULL && (bp = extend_heap(h, MAX(newsize, CHUNKSIZE))) == NULL)
+      return NULL;  /* Heap extension failed */
 
-    /* Heap extension failed */
-    return NULL;
+    bp = place(h, bp, newsize);
+
+    /* Hand about one allocation per sampling interval to the profiler */
+    if ((mmprof_countdown -= size) < 0 && mmprof_record(bp, size))
+      SET_SAMPLED(HDRP(bp));
+    h->stats.mallocs++;
+
+    /* A heap that only allocates for a while still ages its free blocks */
+    if (--h->purge_countdown < 0)
+      purge_tick(h);
+    return bp;
 }
 
 /*
- * mm_free - Free a block.
+ * mm_malloc - Allocate a block from the default heap.
  */
-void mm_free(void *ptr)
+void *mm_malloc(size_t size)
+{
+    return mm_malloc_r(&mm_heap, size);
+}
+
+/*
+ * mm_free_r - Free a block of heap h.
+ */
+void mm_free_r(mm_heap_t *h, void *ptr)
 {
-  size_t size = GET_SIZE(HDRP(ptr));
-  
+  size_t size;
+
+  if (ptr == NULL)
+    return;
+  size = GET_SIZE(HDRP(ptr));
+  if (GET_SAMPLED(HDRP(ptr)))
+    mmprof_forget(ptr);
   PUT(HDRP(ptr), PACK(size, 0));
   PUT(FTRP(ptr), PACK(size, 0));
-  coalesce(ptr);
+  coalesce(h, ptr);
+  h->stats.frees++;
+
+  /* Every so often, give back memory that has been free long enough */
+  if (--h->purge_countdown < 0)
+    purge_tick(h);
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_free - Free a block of the default heap.
  */
-void *mm_realloc(void *ptr, size_t size)
+void mm_free(void *ptr)
+{
+    mm_free_r(&mm_heap, ptr);
+}
+
+/*
+ * mm_realloc_r - Keep the block if it is already large enough for size
+ *     bytes; otherwise move it with mm_malloc_r and mm_free_r. As in
+ *     libc, a NULL ptr means mm_malloc_r and a size of 0 mm_free_r.
+ */
+void *mm_realloc_r(mm_heap_t *h, void *ptr, size_t size)
 {
     void *oldptr = ptr;
     void *newptr;
-    size_t copySize;
+    size_t copySize, asize = ALIGN(size);
+    int gc_flags = h->gc_flags, c;
+
+    if (ptr == NULL)
+      return mm_malloc_r(h, size);
+    if (size == 0) {
+      mm_free_r(h, ptr);
+      return NULL;
+    }
+
+    if (asize <= GET_SIZE(HDRP(oldptr)) - DSIZE) {
+      /* Give back the tail, down to the size mm_malloc_r would use */
+      if ((c = size_class(h, asize)) >= 0)
+        asize = h->limits[c];
+      if (asize <= GET_SIZE(HDRP(oldptr)) - DSIZE)
+        shrink_block(h, oldptr, asize + DSIZE);
+      h->stats.realloc_inplace++;
+      return oldptr;
+    }
+    h->stats.realloc_copy++;
     
-    newptr = mm_malloc(size);
+    /* oldptr may not be reachable from any root, so don't collect here */
+    h->gc_flags &= ~MM_GC_AUTO;
+    newptr = mm_malloc_r(h, size);
+    h->gc_flags = gc_flags;
     if (newptr == NULL)
       return NULL;
 
-    copySize = MIN(GET_SIZE(HDRP(oldptr)), size);
+    copySize = MIN(GET_SIZE(HDRP(oldptr)) - DSIZE, size);
     memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
+    mm_free_r(h, oldptr);
     return newptr;
 }
 
+/*
+ * mm_realloc - Reallocate a block of the default heap.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_realloc_r(&mm_heap, ptr, size);
+}
+
+
+
 
 
+/*****************************************************************
+ * Conservative mark-and-sweep garbage collection (CS:APP 9.10).
+ *
+ * Any aligned word in a root range or in a reachable payload that
+ * points into an allocated block keeps that block alive; interior
+ * pointers count. Reachable blocks get the header mark bit, then the
+ * sweep frees and coalesces every allocated block left unmarked.
+ * Pointers held only in memory the collector does not scan (e.g. the
+ * libc heap, or the stacks of threads other than the collecting one)
+ * must be registered with mm_gc_add_root.
+ ****************************************************************/
+
+extern char __data_start[], _end[];  /* data and bss segments (glibc) */
+extern void *__libc_stack_end;       /* base of the main thread stack */
+
+/* Scratch state for one collection */
+typedef struct {
+  char **blks;     /* payloads of allocated blocks, in address order */
+  int nblks;
+  char **stack;    /* marked blocks whose payload is not scanned yet */
+  int nstack, maxstack;
+} gc_state_t;
+
+/*
+ * gc_find_block - Return the allocated block whose payload contains
+ *     address p, or NULL. Binary search over the address-ordered index.
+ */
+static char *gc_find_block(gc_state_t *gc, char *p) {
+  int lo = 0, hi = gc->nblks - 1;
+
+  if (gc->nblks == 0 || p < gc->blks[0])
+    return NULL;
+  while (lo < hi) {  // find the last block starting at or below p
+    int mid = (lo + hi + 1) / 2;
+    if (gc->blks[mid] <= p)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  if (p < FTRP(gc->blks[lo]))
+    return gc->blks[lo];
+  return NULL;
+}
+
+/*
+ * gc_scan - Mark every unmarked block referenced from [lo, hi) and
+ *     push it on the mark stack.
+ */
+static void gc_scan(gc_state_t *gc, char *lo, char *hi) {
+  char **wp = (char **)ALIGN((size_t)lo);
+
+  for (; (char *)(wp + 1) <= hi; wp++) {
+    char *bp = gc_find_block(gc, *wp);
+    if (bp == NULL || GET_MARK(HDRP(bp)))
+      continue;
+    SET_MARK(HDRP(bp));
+    if (gc->nstack == gc->maxstack) {
+      gc->maxstack = gc->maxstack ? 2 * gc->maxstack : 256;
+      if ((gc->stack = realloc(gc->stack, gc->maxstack * sizeof(char *))) == NULL) {
+        fprintf(stderr, "mm_gc_collect: out of memory for the mark stack\n");
+        exit(1);
+      }
+    }
+    gc->stack[gc->nstack++] = bp;
+  }
+}
+
+/*
+ * gc_stack_top - Return the upper end of the calling thread's stack.
+ *     The main thread's is __libc_stack_end; another thread's comes
+ *     from its pthread attributes, as its stack lives elsewhere.
+ */
+static char *gc_stack_top(void) {
+  pthread_attr_t attr;
+  void *lo;
+  size_t size;
+
+  if (getpid() == syscall(SYS_gettid))
+    return (char *)__libc_stack_end;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0 ||
+      pthread_attr_getstack(&attr, &lo, &size) != 0) {
+    fprintf(stderr, "mm_gc_collect: cannot find the thread stack\n");
+    exit(1);
+  }
+  pthread_attr_destroy(&attr);
+  return (char *)lo + size;
+}
+
+/*
+ * gc_mark - Mark everything reachable from the roots of heap h.
+ */
+static void gc_mark(mm_heap_t *h, gc_state_t *gc) {
+  jmp_buf regs;
+  int i;
+
+  if (h->gc_flags & MM_GC_STACK) {
+    setjmp(regs);  // spill callee-saved registers onto the stack
+    gc_scan(gc, (char *)&regs, gc_stack_top());
+  }
+  if (h->gc_flags & MM_GC_DATA)
+    gc_scan(gc, __data_start, _end);
+  for (i = 0; i < h->gc_nroots; i++)
+    gc_scan(gc, h->gc_roots[2*i], h->gc_roots[2*i + 1]);
+
+  /* Transitively scan the payloads of marked blocks */
+  while (gc->nstack > 0) {
+    char *bp = gc->stack[--gc->nstack];
+    gc_scan(gc, bp, FTRP(bp));
+  }
+}
+
+/*
+ * gc_sweep - Free every unmarked allocated block and clear the marks.
+ *     Returns the number of bytes reclaimed.
+ */
+static size_t gc_sweep(mm_heap_t *h) {
+  size_t freed = 0;
+  char *bp = NEXT_BLKP(h->heap_listp);
+
+  while (GET_SIZE(HDRP(bp)) != 0) {
+    size_t size = GET_SIZE(HDRP(bp));
+    if (GET_ALLOC(HDRP(bp))) {
+      if (GET_MARK(HDRP(bp))) {
+        CLR_MARK(HDRP(bp));
+      } else {
+        if (GET_SAMPLED(HDRP(bp)))
+          mmprof_forget(bp);
+        PUT(HDRP(bp), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, 0));
+        bp = coalesce(h, bp);
+        h->stats.frees++;
+        freed += size;
+      }
+    }
+    bp = NEXT_BLKP(bp);
+  }
+  return freed;
+}
+
+/*
+ * mm_gc_collect_r - Run one conservative mark-and-sweep collection of
+ *     heap h. Returns the number of bytes reclaimed.
+ */
+size_t mm_gc_collect_r(mm_heap_t *h)
+{
+    gc_state_t gc = {NULL, 0, NULL, 0, 0};
+    int maxblks = 0;
+    size_t freed;
+    char *bp;
+
+    /* Index the allocated blocks so roots can be resolved by address */
+    for (bp = NEXT_BLKP(h->heap_listp); GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp)) {
+      if (!GET_ALLOC(HDRP(bp)))
+        continue;
+      if (gc.nblks == maxblks) {
+        maxblks = maxblks ? 2 * maxblks : 256;
+        if ((gc.blks = realloc(gc.blks, maxblks * sizeof(char *))) == NULL) {
+          fprintf(stderr, "mm_gc_collect: out of memory for the block index\n");
+          exit(1);
+        }
+      }
+      gc.blks[gc.nblks++] = bp;
+    }
+
+    gc_mark(h, &gc);
+    freed = gc_sweep(h);
+    free(gc.blks);
+    free(gc.stack);
+
+    h->gc_next = 2 * mem_heapsize_r(h->mem);
+    return freed;
+}
+
+/*
+ * mm_gc_enable_r - Select the root sources and policy (MM_GC_xxx flags)
+ *     used by collections of heap h.
+ */
+void mm_gc_enable_r(mm_heap_t *h, int flags)
+{
+    h->gc_flags = flags;
+}
+
+/*
+ * mm_gc_add_root_r - Treat the len bytes at lo as a root of heap h.
+ *     Returns 0 on success, -1 if out of memory.
+ */
+int mm_gc_add_root_r(mm_heap_t *h, void *lo, size_t len)
+{
+    if (h->gc_nroots == h->gc_maxroots) {
+      int maxroots = h->gc_maxroots ? 2 * h->gc_maxroots : 8;
+      void **roots = realloc(h->gc_roots, 2 * maxroots * sizeof(void *));
+      if (roots == NULL)
+        return -1;
+      h->gc_roots = roots;
+      h->gc_maxroots = maxroots;
+    }
+    h->gc_roots[2*h->gc_nroots] = lo;
+    h->gc_roots[2*h->gc_nroots + 1] = (char *)lo + len;
+    h->gc_nroots++;
+    return 0;
+}
+
+/*
+ * mm_gc_remove_root_r - Forget the root range starting at lo.
+ */
+void mm_gc_remove_root_r(mm_heap_t *h, void *lo)
+{
+    int i;
+
+    for (i = 0; i < h->gc_nroots; i++) {
+      if (h->gc_roots[2*i] == lo) {
+        h->gc_nroots--;
+        h->gc_roots[2*i] = h->gc_roots[2*h->gc_nroots];
+        h->gc_roots[2*i + 1] = h->gc_roots[2*h->gc_nroots + 1];
+        return;
+      }
+    }
+}
+
+/*
+ * mm_gc_* - Collector interface for the default heap.
+ */
+size_t mm_gc_collect(void)
+{
+    return mm_gc_collect_r(&mm_heap);
+}
+
+void mm_gc_enable(int flags)
+{
+    mm_gc_enable_r(&mm_heap, flags);
+}
+
+int mm_gc_add_root(void *lo, size_t len)
+{
+    return mm_gc_add_root_r(&mm_heap, lo, len);
+}
+
+void mm_gc_remove_root(void *lo)
+{
+    mm_gc_remove_root_r(&mm_heap, lo);
+}
@@ -1,10 +1,125 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 
+#include "memlib.h"
+
+#define MM_MAXCLASSES 64  /* most size classes a heap can use */
+#define MM_NLARGE     32  /* lists of blocks above the largest class */
+
+/* Size class tables (mm_set_classes) */
+#define MM_CLASSES_POW2     0  /* powers of two (the default) */
+#define MM_CLASSES_PROFILED 1  /* fitted to the traces, see sizeclasses.h */
+
+/* Memory return policy (mm_set_return) */
+#define MM_TRIM_DEFAULT  (128*1024) /* trim a free top block of this size */
+#define MM_DECAY_DEFAULT 10         /* ms a large free block stays dirty */
+
+/*
+ * mm_stats_t - a snapshot of the state and activity of one heap (mm_stats).
+ * The activity counters are updated as the heap runs and cleared by
+ * mm_init_r; the state is measured when the snapshot is taken.
+ */
+typedef struct {
+    /* state at the time of the snapshot */
+    size_t heap_bytes;     /* size of the heap, as mem_heapsize */
+    size_t alloc_bytes;    /* bytes in allocated blocks, headers included */
+    size_t alloc_blocks;   /* number of allocated blocks */
+    size_t free_bytes;     /* bytes in free blocks, headers included */
+    size_t free_blocks;    /* number of free blocks */
+    int list_blocks[MM_MAXCLASSES + MM_NLARGE]; /* free blocks on each list */
+
+    /* activity since mm_init_r */
+    size_t mallocs;        /* blocks allocated, by mm_malloc or mm_realloc */
+    size_t frees;          /* blocks freed, by mm_free, mm_realloc or the GC */
+    size_t sbrks;          /* heap extensions */
+    size_t splits;         /* free blocks split by an allocation */
+    size_t coalesces;      /* merges of a free block with a neighbor */
+    size_t realloc_inplace; /* mm_realloc calls that kept the block */
+    size_t realloc_copy;    /* mm_realloc calls that moved the block */
+    size_t trimmed;        /* bytes given back by shrinking the heap */
+    size_t purged;         /* bytes of free blocks given back with madvise */
+} mm_stats_t;
+
+/*
+ * mm_heap_t - the state of one independent mm heap. The mm_*_r
+ * functions operate on an explicit heap; the plain mm_* functions
+ * operate on a default heap backed by the memlib default heap.
+ */
+typedef struct {
+    mem_t *mem;        /* simulated memory backing this heap */
+    void *heap_listp;  /* payload of the prologue block */
+
+    /* segregated free lists: heads as offsets from the heap start, 0 = empty */
+    unsigned int lists[MM_MAXCLASSES + MM_NLARGE];
+    int classes;                 /* MM_CLASSES_xxx table to use */
+    const unsigned int *limits;  /* largest request of each size class */
+    int nclasses;                /* number of size classes */
+
+    /* garbage collector state (see mm_gc_collect) */
+    int gc_flags;      /* MM_GC_xxx flags */
+    size_t gc_next;    /* heap size that triggers the next MM_GC_AUTO run */
+    void **gc_roots;   /* explicit roots, stored as [lo, hi) pairs */
+    int gc_nroots;     /* number of explicit root ranges */
+    int gc_maxroots;   /* capacity of gc_roots, in ranges */
+
+    /* memory return policy (see mm_set_return_r) */
+    size_t trim;                 /* trim threshold in bytes, 0 = never */
+    long decay_ms;               /* purge delay in ms, -1 = never */
+    unsigned int purge_epoch;    /* number of the next purge pass */
+    long purge_last;             /* time of the last purge pass, in ms */
+    int purge_countdown;         /* mallocs + frees until the clock is read */
+
+    mm_stats_t stats;  /* activity counters behind mm_stats; the state
+                          fields stay 0 and are filled in by mm_stats */
+} mm_heap_t;
+
+/* Root sources and policy for the conservative collector */
+#define MM_GC_STACK 0x1  /* scan the stack of the calling thread, main or not */
+#define MM_GC_DATA  0x2  /* scan the data and bss segments */
+#define MM_GC_AUTO  0x4  /* collect before growing the heap */
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+extern mm_heap_t *mm_heap_create(size_t maxsize);
+extern void mm_heap_destroy(mm_heap_t *heap);
+extern int mm_init_r(mm_heap_t *heap);
+extern void *mm_malloc_r(mm_heap_t *heap, size_t size);
+extern void mm_free_r(mm_heap_t *heap, void *ptr);
+extern void *mm_realloc_r(mm_heap_t *heap, void *ptr, size_t size);
+
+/* Select the size class table; takes effect at the next mm_init */
+extern void mm_set_classes(int classes);
+extern void mm_set_classes_r(mm_heap_t *heap, int classes);
+
+/* Set when and how free memory is given back; takes effect at once */
+extern void mm_set_return(size_t trim, long decay_ms);
+extern void mm_set_return_r(mm_heap_t *heap, size_t trim, long decay_ms);
+
+/* Give back what the policy allows now; for idle callers, every so often */
+extern size_t mm_purge(void);
+extern size_t mm_purge_r(mm_heap_t *heap);
+
+/* Free list a request is served from, for testing the class lookup */
+extern int mm_size_class_r(mm_heap_t *heap, size_t size);
+
+/* Copy the statistics of a heap into *stats */
+extern void mm_stats(mm_stats_t *stats);
+extern void mm_stats_r(mm_heap_t *heap, mm_stats_t *stats);
+
+extern void mm_gc_enable(int flags);
+extern int mm_gc_add_root(void *lo, size_t len);
+extern void mm_gc_remove_root(void *lo);
+extern size_t mm_gc_collect(void);
+extern void mm_gc_enable_r(mm_heap_t *heap, int flags);
+extern int mm_gc_add_root_r(mm_heap_t *heap, void *lo, size_t len);
+extern void mm_gc_remove_root_r(mm_heap_t *heap, void *lo);
+extern size_t mm_gc_collect_r(mm_heap_t *heap);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
@@ -21,3 +136,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* __MM_H_ */
@@ -0,0 +1,318 @@
+/*
+ * mmh.c - Handle-based relocatable allocator with incremental compaction.
+ *
+ * Blocks are carved from the top of a private memlib heap by bumping
+ * the brk pointer. Each block starts with a two-word header holding
+ * its size (with the allocated bit) and the handle that owns it, so
+ * the compactor can walk the heap in address order and fix up the
+ * handle table as it slides live blocks down over the holes left by
+ * mm_hfree. When a compaction cycle reaches the brk, everything above
+ * the last live block is returned to memlib.
+ *
+ * The compactor is incremental: each call moves a bounded number of
+ * bytes and remembers where it stopped. Blocks allocated during a
+ * cycle land above the scan pointer and are visited later in the same
+ * cycle. With a non-zero budget, mm_halloc runs one compaction step
+ * per request whenever more than half of the heap is holes; the step
+ * moves the budget plus twice the requested size, so compaction keeps
+ * pace with allocation. A request that finds the heap full finishes
+ * the current cycle before giving up, unless the heap has no holes for
+ * the cycle to reclaim. mm_hrealloc grows a block in place over the
+ * holes above it when it can, and otherwise copies it to the top with
+ * a quarter more room, so a block that keeps growing rarely moves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmh.h"
+#include "memlib.h"
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+#define WSIZE 4
+#define HSIZE 8               /* block header: size|alloc, then handle */
+#define MIN_HOLES (1<<12)     /* don't start a cycle for less slack */
+
+#define PACK(size, alloc) ((size) | (alloc))
+
+#define GET(p)        (*(unsigned int *)(p))
+#define PUT(p, val)   (*(unsigned int *)(p) = (val))
+
+#define GET_SIZE(p)   (GET(p) & ~0x7)
+#define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_HANDLE(p) GET((char *)(p) + WSIZE)
+
+/* Given a payload ptr, compute the address of its header */
+#define HDRP(bp)      ((char *)(bp) - HSIZE)
+
+/* Current brk of heap hh: one past the last heap byte */
+#define BRK(hh)       ((char *)mem_heap_hi_r((hh)->mem) + 1)
+
+/*
+ * get_handle - Return an unused handle, growing the table if needed.
+ */
+static mm_handle_t get_handle(mm_hheap_t *hh) {
+  int i, ntable;
+  void **table;
+  int *free_handles;
+
+  if (hh->nfree > 0)
+    return hh->free_handles[--hh->nfree];
+
+  ntable = hh->ntable ? 2 * hh->ntable : 256;
+  if ((table = realloc(hh->table, ntable * sizeof(void *))) == NULL)
+    return MM_HNULL;
+  hh->table = table;
+  if ((free_handles = realloc(hh->free_handles, ntable * sizeof(int))) == NULL)
+    return MM_HNULL;
+  hh->free_handles = free_handles;
+
+  /* Push the new handles so the lowest ones are handed out first */
+  for (i = ntable - 1; i >= hh->ntable; i--) {
+    hh->table[i] = NULL;
+    hh->free_handles[hh->nfree++] = i;
+  }
+  hh->ntable = ntable;
+  return hh->free_handles[--hh->nfree];
+}
+
+/*
+ * room - Return true if the brk can move up by n bytes. A full heap is
+ *     an expected event here, so check it before mem_sbrk_r reports it
+ *     as an error.
+ */
+static int room(mm_hheap_t *hh, size_t n) {
+  return n <= (size_t)(hh->mem->max_addr - BRK(hh));
+}
+
+/*
+ * alloc_block - Bump-allocate a block of bsize bytes owned by handle h.
+ *     Returns the payload pointer, or NULL if the heap is full.
+ */
+static char *alloc_block(mm_hheap_t *hh, size_t bsize, mm_handle_t h) {
+  char *hdr;
+
+  if (!room(hh, bsize) || (hdr = mem_sbrk_r(hh->mem, bsize)) == (void *)-1)
+    return NULL;
+  PUT(hdr, PACK(bsize, 1));
+  GET_HANDLE(hdr) = h;
+  hh->live += bsize;
+  return hdr + HSIZE;
+}
+
+/*
+ * release_block - Turn the block with payload bp into a hole. A block at
+ *     the very top of the heap is given back to memlib right away unless
+ *     the compactor has already passed over it. Once the last live block
+ *     is gone the whole heap is given back, without a compaction cycle.
+ */
+static void release_block(mm_hheap_t *hh, char *bp) {
+  char *hdr = HDRP(bp);
+  size_t bsize = GET_SIZE(hdr);
+
+  hh->live -= bsize;
+  if (hh->live == 0) {
+    hh->scan = hh->dst = NULL;
+    mem_sbrk_r(hh->mem, -(int)mem_heapsize_r(hh->mem));
+  }
+  else if (hdr + bsize == BRK(hh) && (hh->scan == NULL || hdr >= hh->scan))
+    mem_sbrk_r(hh->mem, -(int)bsize);
+  else
+    PUT(hdr, PACK(bsize, 0));
+}
+
+/*
+ * grow_block - Grow the block at hdr to bsize bytes in place, absorbing
+ *     the holes above it and moving the brk if they run up to the top.
+ *     Headers below the scan pointer are stale, so a block the compactor
+ *     has already visited never grows. Returns 1 on success, 0 if the
+ *     block has to move.
+ */
+static int grow_block(mm_hheap_t *hh, char *hdr, size_t bsize) {
+  char *brk = BRK(hh);
+  size_t oldsize = GET_SIZE(hdr);
+  size_t size = oldsize;
+
+  if (hh->scan != NULL && hdr < hh->scan)
+    return 0;
+  while (size < bsize && hdr + size < brk && !GET_ALLOC(hdr + size))
+    size += GET_SIZE(hdr + size);
+  if (size < bsize) {
+    if (hdr + size != brk || !room(hh, bsize - size))
+      return 0;
+    mem_sbrk_r(hh->mem, bsize - size);
+    size = bsize;
+  }
+  if (size > bsize)
+    PUT(hdr + bsize, PACK(size - bsize, 0));
+  PUT(hdr, PACK(bsize, 1));
+  hh->live += bsize - oldsize;
+  return 1;
+}
+
+/*
+ * squeeze - Finish the compaction cycle after an allocation found the
+ *     heap full. Returns 0 without walking the heap if it has no holes,
+ *     since the cycle would free nothing.
+ */
+static int squeeze(mm_hheap_t *hh) {
+  if (mem_heapsize_r(hh->mem) == hh->live)
+    return 0;
+  mm_hcompact(hh, (size_t)-1);
+  return 1;
+}
+
+/*
+ * mm_hheap_create - Create a handle heap of at most maxsize bytes.
+ *     mm_halloc moves up to budget bytes per request (0 = never compact
+ *     implicitly).
+ */
+mm_hheap_t *mm_hheap_create(size_t maxsize, size_t budget)
+{
+    mm_hheap_t *hh;
+
+    if ((hh = calloc(1, sizeof(mm_hheap_t))) == NULL)
+      return NULL;
+    hh->mem = mem_create(maxsize);
+    hh->budget = budget;
+    return hh;
+}
+
+/*
+ * mm_hheap_destroy - Release a handle heap and all of its blocks.
+ */
+void mm_hheap_destroy(mm_hheap_t *hh)
+{
+    mem_destroy(hh->mem);
+    free(hh->table);
+    free(hh->free_handles);
+    free(hh);
+}
+
+/*
+ * mm_halloc - Allocate a relocatable block of size bytes.
+ *     Returns its handle, or MM_HNULL on failure.
+ */
+mm_handle_t mm_halloc(mm_hheap_t *hh, size_t size)
+{
+    mm_handle_t h;
+    size_t holes;
+    size_t bsize = HSIZE + ALIGN(size);
+
+    if (size == 0)
+      return MM_HNULL;
+
+    /* Pay for some compaction while the heap is mostly holes */
+    holes = mem_heapsize_r(hh->mem) - hh->live;
+    if (hh->budget && (hh->scan != NULL || (holes > hh->live && holes > MIN_HOLES)))
+      mm_hcompact(hh, hh->budget + 2*bsize);
+
+    if ((h = get_handle(hh)) == MM_HNULL)
+      return MM_HNULL;
+    if ((hh->table[h] = alloc_block(hh, bsize, h)) == NULL) {
+      /* Out of memory: squeeze out every hole and try once more */
+      if (!squeeze(hh) || (hh->table[h] = alloc_block(hh, bsize, h)) == NULL) {
+        hh->free_handles[hh->nfree++] = h;
+        return MM_HNULL;
+      }
+    }
+    return h;
+}
+
+/*
+ * mm_hrealloc - Resize the block of handle h. The handle stays the same;
+ *     the payload may move. Returns h, or MM_HNULL on failure.
+ */
+mm_handle_t mm_hrealloc(mm_hheap_t *hh, mm_handle_t h, size_t size)
+{
+    char *oldp = hh->table[h];
+    char *hdr = HDRP(oldp);
+    size_t oldsize = GET_SIZE(hdr);
+    size_t newsize = HSIZE + ALIGN(size);
+    char *newp;
+
+    if (newsize <= oldsize || grow_block(hh, hdr, newsize))
+      return h;
+
+    /* A block that has to move gets a quarter more to grow into in place */
+    if ((newp = alloc_block(hh, newsize + ALIGN(newsize / 4), h)) == NULL &&
+        (newp = alloc_block(hh, newsize, h)) == NULL) {
+      /* Out of memory: squeeze as mm_halloc does, which may move oldp */
+      if (!squeeze(hh))
+        return MM_HNULL;
+      oldp = hh->table[h];
+      if (grow_block(hh, HDRP(oldp), newsize))
+        return h;
+      if ((newp = alloc_block(hh, newsize, h)) == NULL)
+        return MM_HNULL;
+    }
+    memcpy(newp, oldp, oldsize - HSIZE);
+    release_block(hh, oldp);
+    hh->table[h] = newp;
+    return h;
+}
+
+/*
+ * mm_hderef - Return the current payload address of handle h.
+ */
+void *mm_hderef(mm_hheap_t *hh, mm_handle_t h)
+{
+    return hh->table[h];
+}
+
+/*
+ * mm_hfree - Free the block of handle h and recycle the handle.
+ */
+void mm_hfree(mm_hheap_t *hh, mm_handle_t h)
+{
+    if (h == MM_HNULL)
+      return;
+    release_block(hh, hh->table[h]);
+    hh->table[h] = NULL;
+    hh->free_handles[hh->nfree++] = h;
+}
+
+/*
+ * mm_hcompact - Run the sliding compactor until it has moved budget
+ *     bytes or reached the brk, whichever comes first. A budget of
+ *     (size_t)-1 finishes the cycle. Returns 1 if the cycle completed
+ *     and the heap was trimmed, 0 if more work remains.
+ */
+int mm_hcompact(mm_hheap_t *hh, size_t budget)
+{
+    char *brk = BRK(hh);
+    size_t moved = 0;
+
+    if (hh->scan == NULL)
+      hh->scan = hh->dst = mem_heap_lo_r(hh->mem);
+
+    while (hh->scan < brk) {
+      size_t bsize = GET_SIZE(hh->scan);
+
+      if (GET_ALLOC(hh->scan)) {
+        if (hh->dst != hh->scan) {
+          if (moved >= budget) {
+            hh->moved += moved;
+            return 0;
+          }
+          memmove(hh->dst, hh->scan, bsize);
+          hh->table[GET_HANDLE(hh->dst)] = hh->dst + HSIZE;
+          moved += bsize;
+        }
+        hh->dst += bsize;
+      }
+      hh->scan += bsize;
+    }
+
+    /* Cycle complete: everything above dst is free */
+    mem_sbrk_r(hh->mem, -(int)(brk - hh->dst));
+    hh->scan = hh->dst = NULL;
+    hh->moved += moved;
+    hh->cycles++;
+    return 1;
+}
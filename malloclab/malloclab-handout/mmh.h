@@ -0,0 +1,49 @@
+#ifndef __MMH_H_
+#define __MMH_H_
+
+#include <stdio.h>
+
+#include "memlib.h"
+
+/*
+ * mmh.h - handle-based relocatable allocator. Clients hold integer
+ * handles instead of payload pointers, so the compactor is free to
+ * slide live blocks toward the bottom of the heap and give the space
+ * freed at the top back with a negative mem_sbrk.
+ */
+
+typedef int mm_handle_t;
+#define MM_HNULL (-1)
+
+typedef struct {
+    mem_t *mem;          /* simulated memory holding the blocks */
+    void **table;        /* handle -> payload pointer, NULL if unused */
+    int ntable;          /* capacity of table */
+    int *free_handles;   /* stack of unused handles */
+    int nfree;           /* number of entries in free_handles */
+    size_t live;         /* bytes in allocated blocks, headers included */
+    size_t moved;        /* total bytes moved by the compactor */
+    int cycles;          /* number of completed compaction cycles */
+
+    /* incremental compactor state */
+    char *scan;          /* next block to visit, NULL if no cycle is running */
+    char *dst;           /* address the next live block slides down to */
+    size_t budget;       /* bytes mm_halloc may move per request (0 = off) */
+} mm_hheap_t;
+
+extern mm_hheap_t *mm_hheap_create(size_t maxsize, size_t budget);
+extern void mm_hheap_destroy(mm_hheap_t *hh);
+
+/*
+ * Payload pointers returned by mm_hderef are only valid until the next
+ * call to mm_halloc, mm_hrealloc or mm_hcompact on the same heap.
+ */
+extern mm_handle_t mm_halloc(mm_hheap_t *hh, size_t size);
+extern mm_handle_t mm_hrealloc(mm_hheap_t *hh, mm_handle_t h, size_t size);
+extern void *mm_hderef(mm_hheap_t *hh, mm_handle_t h);
+extern void mm_hfree(mm_hheap_t *hh, mm_handle_t h);
+
+/* Move at most budget bytes; returns 1 when a compaction cycle completes */
+extern int mm_hcompact(mm_hheap_t *hh, size_t budget);
+
+#endif /* __MMH_H_ */
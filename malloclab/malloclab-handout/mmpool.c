@@ -0,0 +1,126 @@
+/*
+ * mmpool.c - Fixed-size pool allocator with occupancy bitmaps.
+ *
+ * The pool owns a private memlib heap and grows it one MM_POOL_PAGE
+ * page at a time. A page starts with an mm_pool_page_t header, whose
+ * bitmap has one bit per slot (bits past the last slot are set, so
+ * they are never handed out), followed by the slots. Objects carry no
+ * header: mm_pool_free finds the page of an object by masking its
+ * address, which works because every page is page aligned.
+ *
+ * Pages with a free slot are kept on a LIFO list. mm_pool_alloc takes
+ * the lowest free slot of the first page on the list with a count of
+ * trailing ones per bitmap word, and drops the page from the list when
+ * it fills up; mm_pool_free puts a full page back on the list. Pages
+ * are never returned to memlib before mm_pool_destroy.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmpool.h"
+#include "memlib.h"
+
+/* rounds up to the nearest multiple of 8 */
+#define ALIGN(size) (((size) + 7) & ~(size_t)0x7)
+
+/* The page holding object p */
+#define PAGEP(p) ((mm_pool_page_t *)((uintptr_t)(p) & ~(uintptr_t)(MM_POOL_PAGE-1)))
+
+/* Current brk of pool p: one past the last heap byte */
+#define BRK(p)   ((char *)mem_heap_hi_r((p)->mem) + 1)
+
+/*
+ * new_page - Carve a new page and put it on the avail list.
+ *     Returns the page, or NULL if the heap is full.
+ */
+static mm_pool_page_t *new_page(mm_pool_t *pool) {
+  mm_pool_page_t *pg;
+  int i;
+
+  if ((pg = mem_sbrk_r(pool->mem, MM_POOL_PAGE)) == (void *)-1)
+    return NULL;
+  memset(pg->used, 0, sizeof(pg->used));
+  for (i = pool->nslots; i < 64 * MM_POOL_WORDS; i++)
+    pg->used[i / 64] |= (uint64_t)1 << (i % 64);
+  pg->nfree = pool->nslots;
+  pg->next = pool->avail;
+  pool->avail = pg;
+  pool->npages++;
+  return pg;
+}
+
+/*
+ * mm_pool_create - Create a pool of objects of objsize bytes backed by
+ *     a heap of at most maxsize bytes. Returns NULL if objsize does not
+ *     fit in a page.
+ */
+mm_pool_t *mm_pool_create(size_t objsize, size_t maxsize)
+{
+    mm_pool_t *pool;
+    size_t first = ALIGN(sizeof(mm_pool_page_t));
+    size_t pad;
+
+    objsize = ALIGN(objsize ? objsize : 1);
+    if (objsize > MM_POOL_PAGE - first)
+      return NULL;
+    if ((pool = calloc(1, sizeof(mm_pool_t))) == NULL)
+      return NULL;
+    pool->mem = mem_create(maxsize + MM_POOL_PAGE);
+    pool->objsize = objsize;
+    pool->first = first;
+    pool->nslots = (MM_POOL_PAGE - first) / objsize;
+    if (pool->nslots > 64 * MM_POOL_WORDS)
+      pool->nslots = 64 * MM_POOL_WORDS;
+
+    /* Start the first page on a page boundary */
+    pad = -(uintptr_t)BRK(pool) & (MM_POOL_PAGE - 1);
+    if (pad > 0 && mem_sbrk_r(pool->mem, pad) == (void *)-1) {
+      mm_pool_destroy(pool);
+      return NULL;
+    }
+    return pool;
+}
+
+/*
+ * mm_pool_destroy - Release a pool and every object in it.
+ */
+void mm_pool_destroy(mm_pool_t *pool)
+{
+    mem_destroy(pool->mem);
+    free(pool);
+}
+
+/*
+ * mm_pool_alloc - Allocate one object. Returns NULL if the heap is full.
+ */
+void *mm_pool_alloc(mm_pool_t *pool)
+{
+    mm_pool_page_t *pg = pool->avail;
+    int w, b;
+
+    if (pg == NULL && (pg = new_page(pool)) == NULL)
+      return NULL;
+    for (w = 0; pg->used[w] == ~(uint64_t)0; w++)
+      ;
+    b = __builtin_ctzll(~pg->used[w]);
+    pg->used[w] |= (uint64_t)1 << b;
+    if (--pg->nfree == 0)
+      pool->avail = pg->next;
+    return (char *)pg + pool->first + (size_t)(64 * w + b) * pool->objsize;
+}
+
+/*
+ * mm_pool_free - Free an object allocated from pool.
+ */
+void mm_pool_free(mm_pool_t *pool, void *obj)
+{
+    mm_pool_page_t *pg = PAGEP(obj);
+    int i = ((char *)obj - (char *)pg - pool->first) / pool->objsize;
+
+    pg->used[i / 64] &= ~((uint64_t)1 << (i % 64));
+    if (pg->nfree++ == 0) {
+      pg->next = pool->avail;
+      pool->avail = pg;
+    }
+}
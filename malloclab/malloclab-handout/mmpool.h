@@ -0,0 +1,42 @@
+#ifndef __MMPOOL_H_
+#define __MMPOOL_H_
+
+#include <stdint.h>
+
+#include "memlib.h"
+
+/*
+ * mmpool.h - pool allocator for objects of one fixed size. The pool
+ * carves pages of a private memlib heap into equal slots and tracks
+ * them with one occupancy bit each, so an object needs no header and
+ * an allocation is a find-first-zero in a 64-bit word.
+ */
+
+#define MM_POOL_PAGE  4096  /* bytes per pool page, page aligned */
+#define MM_POOL_WORDS 8     /* bitmap words per page: up to 512 slots */
+
+/* The header at the start of every pool page */
+typedef struct mm_pool_page {
+    uint64_t used[MM_POOL_WORDS];  /* occupancy bitmap, 1 = allocated */
+    struct mm_pool_page *next;     /* next page with a free slot */
+    int nfree;                     /* number of free slots */
+} mm_pool_page_t;
+
+typedef struct {
+    mem_t *mem;             /* simulated memory holding the pages */
+    size_t objsize;         /* slot size, a multiple of 8 */
+    int nslots;             /* slots per page */
+    size_t first;           /* offset of slot 0 from the page start */
+    mm_pool_page_t *avail;  /* pages with at least one free slot */
+    int npages;             /* pages carved so far */
+} mm_pool_t;
+
+extern mm_pool_t *mm_pool_create(size_t objsize, size_t maxsize);
+extern void mm_pool_destroy(mm_pool_t *pool);
+extern void *mm_pool_alloc(mm_pool_t *pool);
+extern void mm_pool_free(mm_pool_t *pool, void *obj);
+
+/* A pool for objects of a given type */
+#define MM_POOL_CREATE(type, maxsize) mm_pool_create(sizeof(type), (maxsize))
+
+#endif /* __MMPOOL_H_ */
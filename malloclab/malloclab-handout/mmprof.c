@@ -0,0 +1,331 @@
+/*
+ * mmprof.c - Sampling heap profiler for the mm package.
+ *
+ * The sampling decision lives on the mm_malloc fast path: each request
+ * subtracts its size from mmprof_countdown, and only when the count goes
+ * negative is mmprof_record called. The gaps between samples are drawn
+ * from an exponential distribution with mean rate bytes, so sampling is
+ * a Poisson process over allocated bytes and a sample of s bytes stands
+ * for s / (1 - e^(-s/rate)) bytes of allocation on average.
+ *
+ * A sample is filed under its call site: the return addresses of the
+ * stack plus the power-of-two size bucket of the request. The block's
+ * header carries a "sampled" bit, so mm_free only calls mmprof_forget
+ * for blocks that are in the sample table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <execinfo.h>
+
+#include "mmprof.h"
+
+#define MAXDEPTH 32     /* deepest call stack recorded */
+#define SKIP 2          /* frames of mmprof_record and mm_malloc_r */
+#define NSITES 4096     /* buckets in the call site table */
+#define NSAMPLES 4096   /* buckets in the sampled block table */
+
+/* A distinct call stack and size bucket */
+typedef struct site {
+    void *frames[MAXDEPTH];
+    int depth;
+    int bucket;           /* request size is at most 1<<bucket bytes */
+    double inuse;         /* estimated bytes still allocated */
+    double alloc;         /* estimated bytes allocated */
+    struct site *next;
+} site_t;
+
+/* A sampled block that has not been freed yet */
+typedef struct sample {
+    void *bp;
+    site_t *site;
+    double weight;        /* estimated bytes this sample stands for */
+    struct sample *next;
+} sample_t;
+
+long mmprof_countdown = LONG_MAX;
+
+static long rate = 0;                 /* mean bytes between samples */
+static unsigned long long seed = 88172645463325252ull;
+static site_t *sites[NSITES];
+static sample_t *samples[NSAMPLES];
+
+static volatile sig_atomic_t dump_requested = 0;  /* signal that asked, or 0 */
+static const char *dump_path = NULL;
+
+/*
+ * prof_log - natural logarithm of x > 0, good to about 1e-7
+ */
+static double prof_log(double x) {
+  int e = 0;
+  double t, t2;
+
+  while (x >= 2.0) { x /= 2.0; e++; }
+  while (x < 1.0) { x *= 2.0; e--; }
+  t = (x - 1) / (x + 1);  // ln x = 2 atanh t
+  t2 = t * t;
+  return e * 0.69314718055994531 + 
+    2 * t * (1 + t2 * (1.0/3 + t2 * (1.0/5 + t2 * (1.0/7 + t2 * (1.0/9)))));
+}
+
+/*
+ * prof_exp_neg - e^(-x) for x >= 0
+ */
+static double prof_exp_neg(double x) {
+  double y, r;
+  int i;
+
+  if (x > 64)
+    return 0;
+  y = x / 1024;  // e^-x = (e^-y)^1024
+  r = 1 - y * (1 - y / 2 * (1 - y / 3 * (1 - y / 4)));
+  for (i = 0; i < 10; i++)
+    r *= r;
+  return r;
+}
+
+/*
+ * next_interval - Draw the number of bytes until the next sample
+ */
+static long next_interval(void) {
+  double u;
+
+  seed ^= seed << 13;  // xorshift64
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  u = (double)((seed >> 11) + 1) / 9007199254740992.0;  // (0, 1]
+  return (long)(-prof_log(u) * rate) + 1;
+}
+
+static unsigned hash_ptr(void *p, unsigned n) {
+  return (unsigned)(((unsigned long)p >> 3) * 2654435761u) % n;
+}
+
+/*
+ * find_site - Look up (or create) the site of a stack and size bucket
+ */
+static site_t *find_site(void **frames, int depth, int bucket) {
+  unsigned long h = bucket;
+  site_t *s;
+  int i;
+
+  for (i = 0; i < depth; i++)
+    h = h * 31 + (unsigned long)frames[i];
+  h %= NSITES;
+
+  for (s = sites[h]; s; s = s->next)
+    if (s->depth == depth && s->bucket == bucket &&
+        !memcmp(s->frames, frames, depth * sizeof(void *)))
+      return s;
+
+  if ((s = calloc(1, sizeof(site_t))) == NULL)
+    return NULL;
+  memcpy(s->frames, frames, depth * sizeof(void *));
+  s->depth = depth;
+  s->bucket = bucket;
+  s->next = sites[h];
+  sites[h] = s;
+  return s;
+}
+
+/*
+ * free_tables - Drop every site and sample
+ */
+static void free_tables(void) {
+  int i;
+
+  for (i = 0; i < NSITES; i++) {
+    while (sites[i]) {
+      site_t *s = sites[i];
+      sites[i] = s->next;
+      free(s);
+    }
+  }
+  for (i = 0; i < NSAMPLES; i++) {
+    while (samples[i]) {
+      sample_t *s = samples[i];
+      samples[i] = s->next;
+      free(s);
+    }
+  }
+}
+
+/*
+ * mmprof_start - Discard any previous profile and sample one allocation
+ *     per rate bytes on average
+ */
+void mmprof_start(long rate_arg)
+{
+    free_tables();
+    rate = rate_arg;
+    mmprof_countdown = (rate > 0) ? next_interval() : LONG_MAX;
+}
+
+/*
+ * mmprof_stop - Stop sampling. The profile gathered so far is kept.
+ */
+void mmprof_stop(void)
+{
+    rate = 0;
+    mmprof_countdown = LONG_MAX;
+}
+
+/*
+ * mmprof_record - Called by mm_malloc when mmprof_countdown goes
+ *     negative. Returns 1 if block bp of size bytes was sampled.
+ */
+int mmprof_record(void *bp, size_t size)
+{
+    void *frames[MAXDEPTH + SKIP];
+    int depth, bucket = 0;
+    sample_t *s;
+    site_t *site;
+    unsigned h;
+
+    if (dump_requested) {
+	FILE *fp;
+	dump_requested = 0;
+	if ((fp = fopen(dump_path, "w")) != NULL) {
+	    mmprof_dump(fp, MMPROF_INUSE);
+	    fclose(fp);
+	}
+    }
+    if (rate == 0) {
+	mmprof_countdown = LONG_MAX;
+	return 0;
+    }
+    mmprof_countdown = next_interval();
+
+    depth = backtrace(frames, MAXDEPTH + SKIP) - SKIP;
+    if (depth < 0)
+	depth = 0;
+    while (((size_t)1 << bucket) < size)
+	bucket++;
+    if ((site = find_site(frames + SKIP, depth, bucket)) == NULL)
+	return 0;
+    if ((s = malloc(sizeof(sample_t))) == NULL)
+	return 0;
+
+    s->bp = bp;
+    s->site = site;
+    s->weight = size / (1 - prof_exp_neg((double)size / rate));
+    site->inuse += s->weight;
+    site->alloc += s->weight;
+
+    h = hash_ptr(bp, NSAMPLES);
+    s->next = samples[h];
+    samples[h] = s;
+    return 1;
+}
+
+/*
+ * mmprof_forget - Called by mm_free for a block that was sampled
+ */
+void mmprof_forget(void *bp)
+{
+    sample_t **pp, *s;
+
+    for (pp = &samples[hash_ptr(bp, NSAMPLES)]; (s = *pp) != NULL; pp = &s->next) {
+	if (s->bp == bp) {
+	    s->site->inuse -= s->weight;
+	    *pp = s->next;
+	    free(s);
+	    return;
+	}
+    }
+}
+
+/*
+ * mmprof_forget_range - Forget every sampled block in [lo, hi), for
+ *     heaps that are reset or destroyed without freeing their blocks
+ */
+void mmprof_forget_range(void *lo, void *hi)
+{
+    sample_t **pp, *s;
+    int i;
+
+    for (i = 0; i < NSAMPLES; i++) {
+	for (pp = &samples[i]; (s = *pp) != NULL; ) {
+	    if ((char *)s->bp >= (char *)lo && (char *)s->bp < (char *)hi) {
+		s->site->inuse -= s->weight;
+		*pp = s->next;
+		free(s);
+	    }
+	    else
+		pp = &s->next;
+	}
+    }
+}
+
+/*
+ * print_frame - Print the function name of a frame from its
+ *     backtrace_symbols() string "object(function+offset) [address]",
+ *     or the address when the name is unknown
+ */
+static void print_frame(FILE *fp, const char *sym) {
+  const char *lp = strchr(sym, '('), *end;
+
+  if (lp && lp[1] != '+' && lp[1] != ')') {
+    for (end = lp + 1; *end && *end != '+' && *end != ')'; end++)
+      ;
+    fprintf(fp, "%.*s", (int)(end - lp - 1), lp + 1);
+  } else if ((lp = strchr(sym, '[')) != NULL) {
+    for (end = lp + 1; *end && *end != ']'; end++)
+      ;
+    fprintf(fp, "%.*s", (int)(end - lp - 1), lp + 1);
+  } else {
+    fputs(sym, fp);
+  }
+}
+
+/*
+ * mmprof_dump - Write the profile in folded-stack format, outermost
+ *     frame first, with the size bucket as the innermost frame.
+ *     Names need the program to be linked with -rdynamic.
+ *     Returns the number of lines written.
+ */
+int mmprof_dump(FILE *fp, int which)
+{
+    site_t *s;
+    char **syms;
+    double value;
+    int i, j, lines = 0;
+
+    for (i = 0; i < NSITES; i++) {
+	for (s = sites[i]; s; s = s->next) {
+	    value = (which == MMPROF_INUSE) ? s->inuse : s->alloc;
+	    if (value < 0.5)
+		continue;
+	    syms = backtrace_symbols(s->frames, s->depth);
+	    for (j = s->depth - 1; j >= 0; j--) {
+		if (syms)
+		    print_frame(fp, syms[j]);
+		else
+		    fprintf(fp, "%p", s->frames[j]);
+		fputc(';', fp);
+	    }
+	    fprintf(fp, "[<=%luB] %.0f\n", 1ul << s->bucket, value);
+	    free(syms);
+	    lines++;
+	}
+    }
+    return lines;
+}
+
+/* Only set the flag: mm_malloc updates mmprof_countdown non-atomically */
+static void dump_handler(int sig) {
+  dump_requested = sig;
+}
+
+/*
+ * mmprof_dump_on_signal - Write the in-use profile to path whenever
+ *     signal sig arrives. The dump is written by the next sampled
+ *     allocation rather than in the handler, where stdio is not safe.
+ */
+void mmprof_dump_on_signal(int sig, const char *path)
+{
+    dump_path = path;
+    signal(sig, dump_handler);
+}
@@ -0,0 +1,31 @@
+#ifndef __MMPROF_H_
+#define __MMPROF_H_
+
+#include <stdio.h>
+
+/*
+ * mmprof.h - sampling heap profiler for the mm package. On average one
+ * allocation per mmprof_start(rate) bytes is sampled: its call stack is
+ * recorded, and the block is tracked until it is freed. Profiles are
+ * written as folded stacks ("frame;frame;...;frame value" per line),
+ * the input format of flamegraph.pl.
+ */
+
+/* Bytes left until the next sample; mm_malloc samples when it drops below 0 */
+extern long mmprof_countdown;
+
+/* What the value of each profile line measures */
+#define MMPROF_INUSE 0  /* estimated bytes still allocated */
+#define MMPROF_ALLOC 1  /* estimated bytes allocated since mmprof_start */
+
+void mmprof_start(long rate);
+void mmprof_stop(void);
+int mmprof_dump(FILE *fp, int which);
+void mmprof_dump_on_signal(int sig, const char *path);
+
+/* Hooks called by the mm package */
+int mmprof_record(void *bp, size_t size);
+void mmprof_forget(void *bp);
+void mmprof_forget_range(void *lo, void *hi);
+
+#endif /* __MMPROF_H_ */
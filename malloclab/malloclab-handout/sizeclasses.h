@@ -0,0 +1,40 @@
+/*
+ * sizeclasses.h - Size classes for the segregated free lists of mm.c,
+ *     generated by tracestat -k 16 -o sizeclasses.h from:
+ * traces/amptjp-bal.rep traces/cccp-bal.rep traces/cp-decl-bal.rep
+ * traces/expr-bal.rep traces/coalescing-bal.rep traces/random-bal.rep
+ * traces/random2-bal.rep traces/binary-bal.rep traces/binary2-bal.rep
+ * traces/realloc-bal.rep traces/realloc2-bal.rep
+ *
+ * DO NOT EDIT; rerun tracestat on new traces instead.
+ */
+#ifndef __SIZECLASSES_H_
+#define __SIZECLASSES_H_
+
+/* Number of classes and the largest request they cover */
+#define SC_NCLASSES 16
+#define SC_MAXSIZE 4096
+
+/* Largest request size in the sc_class table */
+#define SC_LUTMAX 1024
+
+/* Largest (aligned) request size of each class */
+static const unsigned int sc_limits[SC_NCLASSES] = {
+    16, 72, 112, 128, 160, 456, 512, 1048, 1544, 1960,
+    2232, 2672, 3072, 3584, 4072, 4096
+};
+
+/* Class of each request size up to SC_LUTMAX, indexed by (size+7)/8 */
+static const unsigned char sc_class[SC_LUTMAX/8 + 1] = {
+    0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3,
+    3, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6,
+    6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7
+};
+
+#endif /* __SIZECLASSES_H_ */
@@ -0,0 +1,517 @@
+/*
+ * tracestat.c - Characterize malloc lab traces
+ *
+ * Streams over one or more .rep traces and reports, for each of them,
+ * the request size histogram, the lifetimes of the blocks (measured in
+ * operations and in bytes allocated in between), the live heap over
+ * time, and the realloc growth chains. Finally it recommends the size
+ * classes that waste the fewest bytes to rounding over all the traces.
+ * With -o it also writes them as a C header for the segregated lists
+ * of mm.c (see sizeclasses.h).
+ *
+ * Memory use is proportional to the number of ids, not the number of
+ * operations, so traces with millions of requests are fine.
+ *
+ * usage: tracestat [-q] [-k <classes>] [-p <points>] [-o <header>] <trace>...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../mm.h"  /* MM_MAXCLASSES, the most classes mm.c accepts */
+
+#define MAXLINE   1024
+#define ALIGNMENT    8     /* requests are rounded up to this */
+#define MAXCLASS  4096     /* largest size covered by the size classes */
+#define NSMALL    (MAXCLASS/ALIGNMENT)
+#define NLOG        48     /* number of log2 histogram buckets */
+#define NCLASSES    16     /* default number of size classes (-k) */
+#define NPOINTS     20     /* default points on the live heap curve (-p) */
+#define BARWIDTH    40     /* width of the live heap bars */
+#define LUTMAX    1024     /* largest size in the generated class table */
+
+/* What we remember about each id while it is live */
+typedef struct {
+    int size;                /* current payload size, -1 if not live */
+    int first_size;          /* size requested by the first allocation */
+    int reallocs;            /* reallocs since the first allocation */
+    long birth_op;           /* op number of the first allocation */
+    long long birth_clock;   /* bytes allocated before it was born */
+} block_t;
+
+/* Statistics for one trace */
+typedef struct {
+    long ops, allocs, reallocs, frees;
+    long long clock;          /* total bytes requested so far */
+    long long live;           /* bytes in live blocks */
+    long long peak;           /* largest value of live ... */
+    long peak_op;             /* ... and where it happened */
+    long sizes[NLOG];         /* request sizes */
+    long life_ops[NLOG];      /* lifetimes in ops */
+    long life_bytes[NLOG];    /* lifetimes in bytes allocated */
+    long never_freed;         /* blocks still live at the end */
+    long chains[NLOG];        /* reallocs per block */
+    long grew, shrank;        /* realloc steps that grew / shrank */
+    double growth;            /* sum of the growth factors of all steps */
+    long nchains;             /* blocks reallocated at least once ... */
+    double chain_growth;      /* ... and the sum of their final/first sizes */
+} stats_t;
+
+/* Aligned request sizes over all traces, for the size classes */
+static long small_counts[NSMALL+1];  /* index = aligned size / ALIGNMENT */
+static long large_count = 0;         /* requests above MAXCLASS */
+
+static int quiet = 0;  /* only report the size classes (-q) */
+
+/* Function prototypes */
+static int bucket(unsigned long long x);
+static void add_request(stats_t *st, int size);
+static void end_block(stats_t *st, block_t *b, long op);
+static int analyze(char *path, int npoints);
+static void print_hist(char *title, char *unit, long *hist, long total);
+static double waste_of(int *limits, int k, long *counts, long long *wasted);
+static int recommend(long *counts, int n, int k, int *limits);
+static int print_classes(int k, int *limits);
+static void write_header(char *path, int *limits, int n, int argc, 
+			 char **argv);
+static void usage(void);
+
+/*
+ * bucket - Return the log2 histogram bucket of x: 0 for 0, else b for
+ *     2^(b-1) <= x < 2^b
+ */
+static int bucket(unsigned long long x)
+{
+    int b = x ? 64 - __builtin_clzll(x) : 0;
+    return b < NLOG ? b : NLOG-1;
+}
+
+/*
+ * add_request - Account for an allocation or realloc request of size
+ *     bytes
+ */
+static void add_request(stats_t *st, int size)
+{
+    int asize = (size + ALIGNMENT-1) / ALIGNMENT;
+
+    st->sizes[bucket(size)]++;
+    st->clock += size;
+    if (asize <= NSMALL)
+	small_counts[asize]++;
+    else
+	large_count++;
+}
+
+/*
+ * end_block - Record the lifetime and realloc chain of block b, which
+ *     is freed (or still live at the end of the trace) at op
+ */
+static void end_block(stats_t *st, block_t *b, long op)
+{
+    st->life_ops[bucket(op - b->birth_op)]++;
+    st->life_bytes[bucket(st->clock - b->birth_clock)]++;
+    st->chains[bucket(b->reallocs)]++;
+    if (b->reallocs > 0 && b->first_size > 0) {
+	st->nchains++;
+	st->chain_growth += (double)b->size / b->first_size;
+    }
+    st->live -= b->size;
+    b->size = -1;
+}
+
+/*
+ * analyze - Read one trace and print its report. Returns 0, or -1 if
+ *     the trace can't be read.
+ */
+static int analyze(char *path, int npoints)
+{
+    FILE *fp;
+    char line[MAXLINE], *p;
+    int weight, num_ids, num_ops, sugg_heapsize;
+    int i, id, size, point = 1, width;
+    block_t *blocks, *b;
+    stats_t st;
+    long long maxcurve = 0, *curve;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	fprintf(stderr, "tracestat: could not open %s\n", path);
+	return -1;
+    }
+    if (fscanf(fp, "%d %d %d %d\n", &sugg_heapsize, &num_ids,
+	       &num_ops, &weight) != 4 || num_ids < 0 || num_ops < 0) {
+	fprintf(stderr, "tracestat: bad header in %s\n", path);
+	fclose(fp);
+	return -1;
+    }
+    blocks = malloc((num_ids + 1) * sizeof(block_t));
+    curve = calloc(npoints, sizeof(long long));
+    if (blocks == NULL || curve == NULL) {
+	fprintf(stderr, "tracestat: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i <= num_ids; i++)
+	blocks[i].size = -1;
+    memset(&st, 0, sizeof(st));
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (line[0] != 'a' && line[0] != 'r' && line[0] != 'f')
+	    continue;
+	id = strtol(line + 1, &p, 10);
+	size = (line[0] != 'f') ? strtol(p, NULL, 10) : 0;
+	if (id < 0 || id >= num_ids) {
+	    if (line[0] == 'f' && id == -1)  /* free(NULL) */
+		st.frees++;
+	    st.ops++;
+	    continue;
+	}
+	b = &blocks[id];
+
+	switch (line[0]) {
+	case 'r':
+	    if (b->size >= 0) {
+		st.reallocs++;
+		b->reallocs++;
+		if (size > b->size)
+		    st.grew++;
+		else if (size < b->size)
+		    st.shrank++;
+		if (b->size > 0)
+		    st.growth += (double)size / b->size;
+		add_request(&st, size);
+		st.live += size - b->size;
+		b->size = size;
+		break;
+	    }
+	    /* not live: realloc(NULL, size) is a malloc */
+	    /* fall through */
+	case 'a':
+	    if (b->size >= 0)
+		end_block(&st, b, st.ops);
+	    st.allocs++;
+	    b->birth_op = st.ops;
+	    b->birth_clock = st.clock;
+	    b->first_size = size;
+	    b->reallocs = 0;
+	    add_request(&st, size);
+	    b->size = size;
+	    st.live += size;
+	    break;
+	case 'f':
+	    st.frees++;
+	    if (b->size >= 0)
+		end_block(&st, b, st.ops);
+	    break;
+	}
+	st.ops++;
+
+	if (st.live > st.peak) {
+	    st.peak = st.live;
+	    st.peak_op = st.ops;
+	}
+	while (point <= npoints && st.ops >= (long)point * num_ops / npoints) {
+	    curve[point-1] = st.live;
+	    point++;
+	}
+    }
+    fclose(fp);
+    for (i = 0; i < num_ids; i++)
+	if (blocks[i].size >= 0) {
+	    st.never_freed++;
+	    end_block(&st, &blocks[i], st.ops);
+	}
+    if (quiet) {
+	free(blocks);
+	free(curve);
+	return 0;
+    }
+
+    /* Summary */
+    printf("%s: %ld ops (%ld allocs, %ld reallocs, %ld frees), "
+	   "%lld bytes requested\n", path, st.ops, st.allocs, st.reallocs,
+	   st.frees, st.clock);
+    printf("peak live heap %lld bytes at op %ld, %ld blocks never freed\n\n",
+	   st.peak, st.peak_op, st.never_freed);
+
+    print_hist("Request sizes", "bytes", st.sizes, st.allocs + st.reallocs);
+    print_hist("Lifetimes in ops", "ops", st.life_ops, st.allocs);
+    print_hist("Lifetimes in bytes allocated", "bytes", st.life_bytes,
+	       st.allocs);
+
+    /* Live heap over time */
+    printf("Live heap:\n%10s%12s\n", "op", "bytes");
+    for (i = 0; i < npoints; i++)
+	if (curve[i] > maxcurve)
+	    maxcurve = curve[i];
+    for (i = 0; i < npoints && i < point-1; i++) {
+	width = maxcurve ? (int)(curve[i] * BARWIDTH / maxcurve) : 0;
+	printf("%10ld%12lld  %.*s\n", (long)(i+1) * num_ops / npoints,
+	       curve[i], width, "########################################");
+    }
+    printf("\n");
+
+    /* Realloc chains */
+    print_hist("Reallocs per block", "reallocs", st.chains, st.allocs);
+    if (st.reallocs > 0)
+	printf("realloc steps: %ld grew, %ld shrank, mean factor %.2f\n"
+	       "realloc chains: %ld blocks, mean final/first size %.1f\n\n",
+	       st.grew, st.shrank, st.growth / st.reallocs, st.nchains,
+	       st.nchains ? st.chain_growth / st.nchains : 0);
+
+    free(blocks);
+    free(curve);
+    return 0;
+}
+
+/*
+ * print_hist - Print a log2 histogram with its cumulative percentages
+ */
+static void print_hist(char *title, char *unit, long *hist, long total)
+{
+    int b, last = 0;
+    long cum = 0;
+
+    printf("%s:\n%24s%10s%8s\n", title, unit, "count", "cum%");
+    for (b = 0; b < NLOG; b++)
+	if (hist[b])
+	    last = b;
+    for (b = 0; b <= last; b++) {
+	cum += hist[b];
+	if (hist[b] == 0)
+	    continue;
+	if (b == 0)
+	    printf("%24d", 0);
+	else
+	    printf("%12llu - %9llu", 1ULL << (b-1), (1ULL << b) - 1);
+	printf("%10ld%7.1f%%\n", hist[b], total ? 100.0 * cum / total : 0);
+    }
+    printf("\n");
+}
+
+/*
+ * waste_of - Return the fraction of the bytes of the small requests in
+ *     counts[] lost to rounding up to the k class limits (in bytes),
+ *     and the lost bytes in *wasted
+ */
+static double waste_of(int *limits, int k, long *counts, long long *wasted)
+{
+    int i, c = 0;
+    long long bytes = 0;
+
+    *wasted = 0;
+    for (i = 1; i <= NSMALL; i++) {
+	if (counts[i] == 0)
+	    continue;
+	while (c < k-1 && limits[c] < i * ALIGNMENT)
+	    c++;
+	*wasted += (long long)counts[i] * (limits[c] - i * ALIGNMENT);
+	bytes += (long long)counts[i] * i * ALIGNMENT;
+    }
+    return bytes ? (double)*wasted / bytes : 0;
+}
+
+/*
+ * recommend - Choose at most k class limits (in bytes) for the aligned
+ *     sizes 1..n in counts[] so the bytes lost to rounding are minimal.
+ *     Dynamic programming over the sizes that occur: best[j][i] is the
+ *     least waste covering the first i of them with j classes, the j'th
+ *     ending at size i. Returns the number of classes used.
+ */
+static int recommend(long *counts, int n, int k, int *limits)
+{
+    int i, j, a, m = 0, *sz, *from;
+    long long *cnt, *sum, *best, cost;
+
+    sz = malloc((n+1) * sizeof(int));
+    cnt = calloc(n+1, sizeof(long long));
+    sum = calloc(n+1, sizeof(long long));
+    best = malloc((k+1) * (n+1) * sizeof(long long));
+    from = malloc((k+1) * (n+1) * sizeof(int));
+    if (!sz || !cnt || !sum || !best || !from) {
+	fprintf(stderr, "tracestat: out of memory\n");
+	exit(1);
+    }
+
+    /* Prefix sums of counts and of count*size over the sizes present */
+    for (i = 1; i <= n; i++)
+	if (counts[i]) {
+	    m++;
+	    sz[m] = i;
+	    cnt[m] = cnt[m-1] + counts[i];
+	    sum[m] = sum[m-1] + (long long)counts[i] * i;
+	}
+    if (k > m)
+	k = m;
+    if (k == 0)
+	goto done;
+
+#define BEST(j, i) best[(j)*(n+1) + (i)]
+#define FROM(j, i) from[(j)*(n+1) + (i)]
+    /* Waste of one class covering sizes a+1..i, in units of ALIGNMENT */
+#define COST(a, i) ((cnt[i] - cnt[a]) * sz[i] - (sum[i] - sum[a]))
+    for (i = 1; i <= m; i++)
+	BEST(1, i) = COST(0, i);
+    for (j = 2; j <= k; j++)
+	for (i = j; i <= m; i++) {
+	    BEST(j, i) = -1;
+	    for (a = j-1; a < i; a++) {
+		cost = BEST(j-1, a) + COST(a, i);
+		if (BEST(j, i) < 0 || cost < BEST(j, i)) {
+		    BEST(j, i) = cost;
+		    FROM(j, i) = a;
+		}
+	    }
+	}
+
+    /* Walk the choices back from the largest size */
+    for (i = m, j = k; j >= 1; j--) {
+	limits[j-1] = sz[i] * ALIGNMENT;
+	if (j > 1)
+	    i = FROM(j, i);
+    }
+
+ done:
+    free(sz);
+    free(cnt);
+    free(sum);
+    free(best);
+    free(from);
+    return k;
+}
+
+/*
+ * print_classes - Print the recommended size classes for all traces,
+ *     and how they compare with power-of-two classes. Stores the class
+ *     limits in limits and returns their number.
+ */
+static int print_classes(int k, int *limits)
+{
+    int i, n, pow2[NSMALL], np2 = 0;
+    long long wasted, p2wasted;
+    double waste, p2waste;
+
+    for (i = ALIGNMENT; i <= MAXCLASS; i *= 2)
+	pow2[np2++] = i;
+    n = recommend(small_counts, NSMALL, k, limits);
+    waste = waste_of(limits, n, small_counts, &wasted);
+    p2waste = waste_of(pow2, np2, small_counts, &p2wasted);
+
+    printf("Size classes for requests up to %d bytes "
+	   "(%ld larger requests not covered):\n", MAXCLASS, large_count);
+    for (i = 0; i < n; i++)
+	printf("%s%d", i ? ", " : "  ", limits[i]);
+    printf("\n%d classes waste %lld bytes (%.1f%%), "
+	   "%d power-of-two classes waste %lld bytes (%.1f%%)\n",
+	   n, wasted, waste * 100, np2, p2wasted, p2waste * 100);
+    return n;
+}
+
+/*
+ * write_header - Write the n class limits as a C header, along with
+ *     a table mapping each aligned request size up to LUTMAX to its
+ *     class. The traces it was fitted to are argv[0..argc-1].
+ */
+static void write_header(char *path, int *limits, int n, int argc, 
+			 char **argv)
+{
+    FILE *fp;
+    int i, c, lutmax = limits[n-1] < LUTMAX ? limits[n-1] : LUTMAX;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	fprintf(stderr, "tracestat: could not open %s\n", path);
+	exit(1);
+    }
+    fprintf(fp, "/*\n * %s - Size classes for the segregated free lists "
+	    "of mm.c,\n *     generated by tracestat -k %d -o %s from:\n *",
+	    path, n, path);
+    for (i = 0, c = 3; i < argc; i++) {
+	if (c + strlen(argv[i]) + 1 > 72) {
+	    fprintf(fp, "\n *");
+	    c = 3;
+	}
+	c += fprintf(fp, " %s", argv[i]);
+    }
+    fprintf(fp, "\n *\n * DO NOT EDIT; rerun tracestat on new traces instead."
+	    "\n */\n");
+    fprintf(fp, "#ifndef __SIZECLASSES_H_\n#define __SIZECLASSES_H_\n\n");
+
+    fprintf(fp, "/* Number of classes and the largest request they cover */\n");
+    fprintf(fp, "#define SC_NCLASSES %d\n#define SC_MAXSIZE %d\n\n", 
+	    n, limits[n-1]);
+    fprintf(fp, "/* Largest request size in the sc_class table */\n");
+    fprintf(fp, "#define SC_LUTMAX %d\n\n", lutmax);
+
+    fprintf(fp, "/* Largest (aligned) request size of each class */\n");
+    fprintf(fp, "static const unsigned int sc_limits[SC_NCLASSES] = {");
+    for (i = 0; i < n; i++)
+	fprintf(fp, "%s%d", i == 0 ? "\n    " : i % 10 ? ", " : ",\n    ", 
+		limits[i]);
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "/* Class of each request size up to SC_LUTMAX, indexed "
+	    "by (size+%d)/%d */\n", ALIGNMENT-1, ALIGNMENT);
+    fprintf(fp, "static const unsigned char sc_class[SC_LUTMAX/%d + 1] = {",
+	    ALIGNMENT);
+    for (i = 0, c = 0; i <= lutmax / ALIGNMENT; i++) {
+	while (limits[c] < i * ALIGNMENT)
+	    c++;
+	fprintf(fp, "%s%d", i == 0 ? "\n    " : i % 16 ? ", " : ",\n    ", c);
+    }
+    fprintf(fp, "\n};\n\n#endif /* __SIZECLASSES_H_ */\n");
+    fclose(fp);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-hq] [-k <classes>] [-p <points>] "
+	    "[-o <header>] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-k <classes> Recommend this many size classes, "
+	    "at most %d (default %d).\n", MM_MAXCLASSES, NCLASSES);
+    fprintf(stderr, "\t-o <header>  Write the size classes to a C header.\n");
+    fprintf(stderr, "\t-p <points>  Points on the live heap curve "
+	    "(default %d).\n", NPOINTS);
+    fprintf(stderr, "\t-q           Only report the size classes.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, n, nclasses = NCLASSES, npoints = NPOINTS, errs = 0, first;
+    int limits[NSMALL];
+    char *header = NULL;
+
+    while ((c = getopt(argc, argv, "hqk:o:p:")) != EOF) {
+	switch (c) {
+	case 'k':
+	    nclasses = atoi(optarg);
+	    break;
+	case 'o':
+	    header = optarg;
+	    break;
+	case 'p':
+	    npoints = atoi(optarg);
+	    break;
+	case 'q':
+	    quiet = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc || nclasses < 1 || nclasses > MM_MAXCLASSES || npoints < 1) {
+	usage();
+	exit(1);
+    }
+
+    for (first = optind; optind < argc; optind++)
+	if (analyze(argv[optind], npoints) < 0)
+	    errs++;
+    n = print_classes(nclasses, limits);
+    if (header != NULL && n > 0)
+	write_header(header, limits, n, argc - first, argv + first);
+    exit(errs ? 1 : 0);
+}